@@ -0,0 +1,255 @@
+#include "./neural_configs/BatchedInferenceServer.h"
+#include <algorithm>
+#include <iostream>
+
+std::shared_ptr<BatchedInferenceServer> BatchedInferenceServer::get (const std::string& model_file,
+                                                                     RAVEProcessor::LoadOptions load_options,
+                                                                     const std::vector<int64_t>& block_shape)
+{
+    static std::mutex registry_mutex;
+    static std::map<std::string, std::weak_ptr<BatchedInferenceServer>> registry;
+
+    auto key = model_file + (load_options.optimize ? "|optimized" : "") + (load_options.quantized ? "|int8" : "");
+
+    for (auto size : block_shape)
+    {
+        key += "|" + std::to_string (size);
+    }
+
+    std::lock_guard<std::mutex> lock (registry_mutex);
+
+    if (auto existing = registry[key].lock())
+    {
+        return existing;
+    }
+
+    auto server = std::make_shared<BatchedInferenceServer> (model_file, load_options, block_shape);
+    registry[key] = server;
+    return server;
+}
+
+BatchedInferenceServer::BatchedInferenceServer (const std::string& model_file, RAVEProcessor::LoadOptions load_options, const std::vector<int64_t>& block_shape)
+    : m_model (RAVEProcessor::Model::acquire (model_file, load_options))
+    , m_lane_shape (block_shape)
+{
+    // Channels are batched for mono models; a stereo model takes them as its own channels
+    if (m_model->stereo && m_lane_shape.size() == 3)
+    {
+        m_lane_shape = { 1, m_lane_shape[0] * m_lane_shape[1], m_lane_shape[2] };
+    }
+
+    for (auto size : m_lane_shape)
+    {
+        m_lane_size *= (size_t) size;
+    }
+
+    m_thread = std::thread ([this] { run(); });
+}
+
+BatchedInferenceServer::~BatchedInferenceServer()
+{
+    {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        m_stopping = true;
+    }
+
+    m_server_cv.notify_all();
+    m_client_cv.notify_all();
+    m_thread.join();
+}
+
+size_t BatchedInferenceServer::registerClient()
+{
+    std::lock_guard<std::mutex> lock (m_mutex);
+
+    auto free_lane = std::find_if (m_lanes.begin(), m_lanes.end(), [] (const Lane& lane)
+                                   { return ! lane.active; });
+
+    if (free_lane == m_lanes.end())
+    {
+        free_lane = m_lanes.insert (m_lanes.end(), Lane {});
+    }
+
+    free_lane->active = true;
+    free_lane->playing = false;
+    free_lane->submitted = false;
+    free_lane->done = false;
+    free_lane->in_batch = false;
+    free_lane->failed = false;
+    free_lane->input.assign (m_lane_size, 0.0f);
+    free_lane->output.assign (m_lane_size, 0.0f);
+
+    return (size_t) std::distance (m_lanes.begin(), free_lane);
+}
+
+void BatchedInferenceServer::unregisterClient (size_t lane)
+{
+    {
+        std::lock_guard<std::mutex> lock (m_mutex);
+        m_lanes[lane].active = false;
+        m_lanes[lane].playing = false;
+        m_lanes[lane].submitted = false;
+    }
+
+    // The tick may have been waiting for this lane only
+    m_server_cv.notify_one();
+}
+
+size_t BatchedInferenceServer::getNumClients() const
+{
+    std::lock_guard<std::mutex> lock (m_mutex);
+    return (size_t) std::count_if (m_lanes.begin(), m_lanes.end(), [] (const Lane& lane)
+                                   { return lane.active; });
+}
+
+bool BatchedInferenceServer::infer (size_t lane, const float* input, float* output, size_t num_output_samples)
+{
+    std::unique_lock<std::mutex> lock (m_mutex);
+    auto& slot = m_lanes[lane];
+
+    // Blocks of the same client go through its lane one at a time, in order
+    m_client_cv.wait (lock, [&] { return ! slot.submitted || m_stopping; });
+
+    if (m_stopping)
+    {
+        return false;
+    }
+
+    std::copy_n (input, m_lane_size, slot.input.data());
+    slot.submitted = true;
+    slot.done = false;
+
+    if (std::none_of (m_lanes.begin(), m_lanes.end(), [&slot] (const Lane& other)
+                      { return &other != &slot && other.submitted && ! other.done; }))
+    {
+        m_tick_start = std::chrono::steady_clock::now();
+    }
+
+    m_server_cv.notify_one();
+    m_client_cv.wait (lock, [&] { return slot.done || m_stopping; });
+
+    if (m_stopping)
+    {
+        return false;
+    }
+
+    auto succeeded = ! slot.failed;
+
+    if (succeeded)
+    {
+        std::copy_n (slot.output.data(), std::min (num_output_samples, m_lane_size), output);
+    }
+
+    slot.submitted = false;
+    slot.done = false;
+    slot.failed = false;
+
+    // Let the client's next block into the lane
+    m_client_cv.notify_all();
+    return succeeded;
+}
+
+bool BatchedInferenceServer::allPlayingLanesSubmitted() const
+{
+    return std::all_of (m_lanes.begin(), m_lanes.end(), [] (const Lane& lane)
+                        { return ! lane.active || ! lane.playing || (lane.submitted && ! lane.done); });
+}
+
+void BatchedInferenceServer::run()
+{
+    c10::InferenceMode guard;
+    std::vector<size_t> batch_lanes;
+    std::vector<c10::IValue> inputs (1);
+    at::Tensor batch;
+
+    std::unique_lock<std::mutex> lock (m_mutex);
+
+    while (! m_stopping)
+    {
+        auto any_submitted = [this]
+        {
+            return std::any_of (m_lanes.begin(), m_lanes.end(), [] (const Lane& lane)
+                                { return lane.active && lane.submitted && ! lane.done; });
+        };
+
+        m_server_cv.wait (lock, [&] { return m_stopping || any_submitted(); });
+        m_server_cv.wait_until (lock, m_tick_start + max_wait, [&] { return m_stopping || allPlayingLanesSubmitted(); });
+
+        if (m_stopping)
+        {
+            break;
+        }
+
+        // Gather the lanes that have a block waiting, in lane order, so that each keeps
+        // its batch position while the same ones play
+        batch_lanes.clear();
+
+        for (size_t i = 0; i < m_lanes.size(); ++i)
+        {
+            auto& lane = m_lanes[i];
+            lane.playing = lane.active && lane.submitted && ! lane.done;
+
+            if (lane.playing)
+            {
+                batch_lanes.push_back (i);
+            }
+        }
+
+        auto batch_shape = m_lane_shape;
+        batch_shape[0] *= (int64_t) batch_lanes.size();
+
+        if (! batch.defined() || batch.sizes() != c10::IntArrayRef (batch_shape))
+        {
+            batch = torch::empty (batch_shape);
+        }
+
+        auto* batch_data = batch.data_ptr<float>();
+
+        for (size_t i = 0; i < batch_lanes.size(); ++i)
+        {
+            auto& lane = m_lanes[batch_lanes[i]];
+            std::copy_n (lane.input.data(), m_lane_size, batch_data + i * m_lane_size);
+            lane.in_batch = true;
+        }
+
+        lock.unlock();
+
+        inputs[0] = batch;
+        at::Tensor output;
+
+        try
+        {
+            output = m_model->m_module.forward (inputs).toTensor().contiguous();
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "[ERROR] batched inference failed: " << e.what() << std::endl;
+        }
+
+        lock.lock();
+
+        // Without an output, every lane in the batch is released with a failure, so that
+        // no client waits on it forever
+        const float* output_data = output.defined() ? output.data_ptr<float>() : nullptr;
+        auto output_lane_size = output.defined() ? (size_t) output.numel() / std::max<size_t> (1, batch_lanes.size()) : 0;
+
+        for (size_t i = 0; i < batch_lanes.size(); ++i)
+        {
+            auto& lane = m_lanes[batch_lanes[i]];
+
+            if (lane.in_batch)
+            {
+                if (output_data != nullptr)
+                {
+                    std::copy_n (output_data + i * output_lane_size, std::min (output_lane_size, m_lane_size), lane.output.data());
+                }
+
+                lane.failed = output_data == nullptr;
+                lane.in_batch = false;
+                lane.done = true;
+            }
+        }
+
+        m_client_cv.notify_all();
+    }
+}
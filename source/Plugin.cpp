@@ -74,14 +74,17 @@ void Plugin::prepareToPlay (double sampleRate, int samplesPerBlock)
     };
 
     cmajorJITProcessor->prepare (processSpec);
+    effectRack.prepare (processSpec);
     neuralProcessor.prepare (processSpec);
     postProcessor.prepare (processSpec);
     outputFIFO.setup ((int) sampleRate);
+    setLatencySamples (neuralProcessor.getLatency());
 }
 
 void Plugin::releaseResources()
 {
     cmajorJITProcessor->reset();
+    effectRack.reset();
     neuralProcessor.reset();
     postProcessor.reset();
 }
@@ -113,6 +116,7 @@ void Plugin::processBlock (juce::AudioBuffer<float>& buffer,
     midiMessages.addEvent (message, 0);
 
     cmajorJITProcessor->process (buffer, midiMessages);
+    effectRack.process (buffer);
 
     auto block = juce::dsp::AudioBlock<float> (buffer);
     auto context = juce::dsp::ProcessContextReplacing<float> (block);
@@ -134,20 +138,84 @@ juce::AudioProcessorEditor* Plugin::createEditor()
 }
 
 //==============================================================================
+// The state is a header followed by one length-prefixed section each for the parameters,
+// the Cmajor patch and every rack slot. Sections are read in isolation, so one that is
+// damaged or can't be parsed is skipped without throwing the others off.
+namespace
+{
+constexpr int stateMagic = 0x504c4753; // "PLGS"
+constexpr int stateVersion = 1;
+
+void writeSection (juce::OutputStream& out, const std::function<void (juce::OutputStream&)>& write)
+{
+    juce::MemoryOutputStream section;
+    write (section);
+
+    out.writeInt64 ((juce::int64) section.getDataSize());
+    out.write (section.getData(), section.getDataSize());
+}
+
+void readSection (juce::InputStream& in, const std::function<void (juce::InputStream&)>& read)
+{
+    auto size = in.readInt64();
+
+    // A bad length means the rest of the stream can't be trusted either
+    if (size < 0 || size > in.getNumBytesRemaining())
+    {
+        in.setPosition (in.getTotalLength());
+        return;
+    }
+
+    juce::MemoryBlock data;
+    in.readIntoMemoryBlock (data, (juce::ssize_t) size);
+
+    if (data.isEmpty())
+        return;
+
+    juce::MemoryInputStream section (data, false);
+
+    try
+    {
+        read (section);
+    }
+    catch (const std::exception& e)
+    {
+        DBG ("Skipped an unreadable state section: " << e.what());
+    }
+}
+} // namespace
+
 void Plugin::getStateInformation (juce::MemoryBlock& destData)
 {
-    // You should use this method to store your parameters in the memory block.
-    // You could do that either as raw data, or use the XML or ValueTree classes
-    // as intermediaries to make it easy to save and load complex data.
-    juce::ignoreUnused (destData);
+    juce::MemoryOutputStream stream (destData, false);
+    stream.writeInt (stateMagic);
+    stream.writeInt (stateVersion);
+
+    writeSection (stream, [this] (juce::OutputStream& out) { apvts.copyState().writeToStream (out); });
+    writeSection (stream, [this] (juce::OutputStream& out) { cmajorJITProcessor->writeSnapshot (out); });
+
+    for (int i = 0; i < CmajorRack::numSlots; ++i)
+        writeSection (stream, [this, i] (juce::OutputStream& out) { effectRack.getSlot (i).writeSnapshot (out); });
 }
 
 void Plugin::setStateInformation (const void* data, int sizeInBytes)
 {
-    // You should use this method to restore your parameters from this memory
-    // block, whose contents will have been created by the getStateInformation()
-    // call.
-    juce::ignoreUnused (data, sizeInBytes);
+    juce::MemoryInputStream stream (data, (size_t) sizeInBytes, false);
+
+    if (stream.readInt() != stateMagic || stream.readInt() != stateVersion)
+        return;
+
+    readSection (stream,
+                 [this] (juce::InputStream& in)
+                 {
+                     if (auto state = juce::ValueTree::readFromStream (in); state.hasType (apvts.state.getType()))
+                         apvts.replaceState (state);
+                 });
+
+    readSection (stream, [this] (juce::InputStream& in) { cmajorJITProcessor->readSnapshot (in); });
+
+    for (int i = 0; i < CmajorRack::numSlots; ++i)
+        readSection (stream, [this, i] (juce::InputStream& in) { effectRack.getSlot (i).readSnapshot (in); });
 }
 
 //==============================================================================
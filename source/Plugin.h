@@ -5,6 +5,7 @@
 
 #include "./processors/NeuralProcessor.h"
 #include "./processors/CmajorProcessor.h"
+#include "./processors/CmajorRack.h"
 #include "./processors/PostProcessor.h"
 #include "./utils/CircularBuffer.h"
 
@@ -63,6 +64,10 @@ public:
 
     auto& getPostProcessor() { return postProcessor; }
 
+    auto& getEffectRack() { return effectRack; }
+
+    auto& getNeuralProcessor() { return neuralProcessor; }
+
     BusesProperties getBusesProperties()
     {
         return BusesProperties()
@@ -87,15 +92,26 @@ private:
         , postProcessor (parameters.postProcessor)
         , neuralProcessor (parameters.neural)
     {
-        auto patch = std::make_shared<cmaj::Patch>();
-        patch->setAutoRebuildOnFileChange (true);
-        patch->createEngine = +[]
+        cmajorJITProcessor = std::make_unique<CmajorJITProcessor> (CmajorJITProcessor::createPatch(), *this);
+        cmajorJITProcessor->loadPatch (std::string (CMAJOR_PATCHES_PATH) + "/Synth/Synth.cmajorpatch");
+
+        neuralProcessor.onLatencyChanged = [this] (int newLatency)
         {
-            return cmaj::Engine::create();
+            setLatencySamples (newLatency);
+        };
+
+        // The neural processor's resamplers are set up in prepare, so only it is prepared
+        // again, with the audio callback held off meanwhile
+        neuralProcessor.onInternalRateChanged = [this]
+        {
+            if (getSampleRate() <= 0.0 || getBlockSize() <= 0)
+                return;
+
+            suspendProcessing (true);
+            neuralProcessor.prepare ({ getSampleRate(), (juce::uint32) getBlockSize(), 2 });
+            setLatencySamples (neuralProcessor.getLatency());
+            suspendProcessing (false);
         };
-        cmajorJITProcessor = std::make_unique<CmajorJITProcessor> (patch, *this);
-        cmajorJITProcessor->loadPatch (
-            "E:\\audio_dev\\Playground\\patches\\Synth\\Synth.cmajorpatch");
     }
 
     juce::AudioProcessorValueTreeState apvts;
@@ -103,6 +119,7 @@ private:
     PostProcessor postProcessor;
     NeuralProcessor neuralProcessor;
     std::unique_ptr<CmajorJITProcessor> cmajorJITProcessor;
+    CmajorRack effectRack { *this };
 
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (Plugin)
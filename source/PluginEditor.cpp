@@ -8,7 +8,8 @@ PluginEditor::PluginEditor (Plugin& p)
     , processorRef (p)
     , cmajorEditor (p.getCmajorProcessor().createUI())
     , postProcessorControls (*this, p.getPostProcessor())
-    , neuralControls (*this, p.parameters.neural)
+    , neuralControls (*this, p.getNeuralProcessor())
+    , rackControls (p.getEffectRack())
     , outputVisualizersManager (p.outputFIFO, juce::Array<AudioReactiveComponent*> { &topPanelComponent.scope, &topPanelComponent.gainMeter })
 {
     juce::ignoreUnused (processorRef);
@@ -24,6 +25,7 @@ PluginEditor::PluginEditor (Plugin& p)
     addAndMakeVisible (bottomPanelComponent);
     addAndMakeVisible (postProcessorControls);
     addAndMakeVisible (neuralControls);
+    addAndMakeVisible (rackControls);
 }
 
 PluginEditor::~PluginEditor() {}
@@ -46,5 +48,6 @@ void PluginEditor::resized()
 
     cmajorEditor->setBounds (area.removeFromLeft ((int) (getWidth() / 3)));
     postProcessorControls.setBounds (area.removeFromRight ((int) (getWidth() / 3)));
+    rackControls.setBounds (area.removeFromTop (32));
     neuralControls.setBounds (area);
 }
@@ -28,6 +28,7 @@ private:
     BottomPanel bottomPanelComponent;
     PostProcessorControls postProcessorControls;
     NeuralControls neuralControls;
+    CmajorRackControls rackControls;
     melatonin::Inspector inspector { *this };
     VisualizationManager outputVisualizersManager;
 
@@ -1,19 +1,260 @@
 #include "./neural_configs/RAVE.h"
+#include "./neural_configs/BatchedInferenceServer.h"
+#include "./neural_configs/RAVEPrePostProcessor.h"
 #include <anira/utils/InferenceBackend.h>
+#include <ATen/Parallel.h>
+#include <algorithm>
+#include <caffe2/serialize/read_adapter_interface.h>
+#include <cstring>
+#include <future>
+#include <map>
+#include <mutex>
+#include <unordered_set>
 
-RAVEProcessor::RAVEProcessor (anira::InferenceConfig& inference_config)
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+#if defined(__unix__) || defined(__APPLE__)
+// Serves a TorchScript archive straight out of a read-only mapping of the file, so
+// loading doesn't stream it through a private read buffer first and the pages stay
+// shared in the page cache. The tensors are still deserialised into their own storage.
+class MappedFileAdapter : public caffe2::serialize::ReadAdapterInterface
+{
+public:
+    explicit MappedFileAdapter (const std::string& file)
+    {
+        auto fd = ::open (file.c_str(), O_RDONLY);
+
+        if (fd < 0)
+        {
+            return;
+        }
+
+        struct stat info;
+
+        if (::fstat (fd, &info) == 0 && info.st_size > 0)
+        {
+            auto* data = ::mmap (nullptr, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (data != MAP_FAILED)
+            {
+                m_data = data;
+                m_size = (size_t) info.st_size;
+            }
+        }
+
+        ::close (fd);
+    }
+
+    ~MappedFileAdapter() override
+    {
+        if (m_data != nullptr)
+        {
+            ::munmap (m_data, m_size);
+        }
+    }
+
+    bool isValid() const { return m_data != nullptr; }
+
+    size_t size() const override { return m_size; }
+
+    size_t read (uint64_t pos, void* buf, size_t n, const char*) const override
+    {
+        if (pos >= m_size)
+        {
+            return 0;
+        }
+
+        n = std::min<size_t> (n, m_size - (size_t) pos);
+        std::memcpy (buf, static_cast<const char*> (m_data) + pos, n);
+        return n;
+    }
+
+private:
+    void* m_data = nullptr;
+    size_t m_size = 0;
+};
+#endif
+
+torch::jit::Module loadModule (const std::string& file)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    if (auto adapter = std::make_shared<MappedFileAdapter> (file); adapter->isValid())
+    {
+        return torch::jit::load (std::shared_ptr<caffe2::serialize::ReadAdapterInterface> (adapter));
+    }
+#endif
+    return torch::jit::load (file);
+}
+
+// Sets an attribute given its dotted path from the root module, e.g. "_rave.decoder.cache"
+void setNestedAttribute (torch::jit::Module root, const std::string& path, const c10::IValue& value)
+{
+    size_t start = 0;
+
+    for (auto dot = path.find ('.'); dot != std::string::npos; dot = path.find ('.', start))
+    {
+        root = root.attr (path.substr (start, dot - start)).toModule();
+        start = dot + 1;
+    }
+
+    root.setattr (path.substr (start), value);
+}
+
+// Runs other on torch's inter-op thread pool while the calling thread runs own, and
+// returns once both are done, rethrowing an error from either
+template <typename Own, typename Other>
+void runConcurrently (Own&& own, Other&& other)
+{
+    std::promise<void> done;
+    auto result = done.get_future();
+
+    at::launch ([&]
+                {
+                    try
+                    {
+                        c10::InferenceMode guard;
+                        other();
+                        done.set_value();
+                    }
+                    catch (...)
+                    {
+                        done.set_exception (std::current_exception());
+                    }
+                });
+
+    try
+    {
+        own();
+    }
+    catch (...)
+    {
+        result.wait();
+        throw;
+    }
+
+    result.get();
+}
+
+// Pads or cuts a latent to the given number of dimensions; the ones a model doesn't
+// have are left at zero
+at::Tensor fitLatent (const at::Tensor& latent, int64_t dimensions)
+{
+    if (latent.size (1) < dimensions)
+    {
+        return torch::constant_pad_nd (latent, { 0, 0, 0, dimensions - latent.size (1) });
+    }
+
+    return latent.size (1) > dimensions ? latent.narrow (1, 0, dimensions) : latent;
+}
+} // namespace
+
+RAVEProcessor::RAVEProcessor (anira::InferenceConfig& inference_config, LoadOptions load_options, const std::string& morph_model_file)
     : BackendBase (inference_config)
 {
-    torch::set_num_threads (1);
+    torch::set_num_threads (std::max (1, InferenceThreading::get().intra_op_threads));
+
+    auto model_path = m_inference_config.get_model_path (anira::InferenceBackend::LIBTORCH);
+
+    // The module is loaded and parsed once; every instance shares its weights. When
+    // batching, the model is the server's, shared with every other batched processor.
+    if (load_options.batched)
+    {
+        auto block_shape = m_inference_config.get_input_shape (anira::InferenceBackend::LIBTORCH)[m_inference_config.m_index_audio_data[anira::Input]];
+        m_server = BatchedInferenceServer::get (model_path, load_options, block_shape);
+        m_model = m_server->getModel();
+        m_server_model = m_model;
+    }
+    else
+    {
+        m_model = Model::acquire (model_path, load_options);
+    }
+
+    auto num_instances = std::clamp<size_t> (m_inference_config.m_num_parallel_processors, 1, InstancePool::max_size);
+
+    // The processor is one client of the server whatever its number of instances: they
+    // take turns on its lane, so the batch only grows with the processors that play
+    if (m_server != nullptr)
+    {
+        m_server_lane = m_server->registerClient();
+    }
+
+    for (size_t i = 0; i < num_instances; ++i)
+    {
+        m_instances.emplace_back (std::make_shared<Instance> (m_inference_config, m_latent_controls, getInstanceModel (m_model, i)));
+
+        if (m_server != nullptr)
+        {
+            m_instances.back()->m_server = m_server.get();
+            m_instances.back()->m_server_lane = m_server_lane;
+        }
+    }
 
-    for (unsigned int i = 0; i < m_inference_config.m_num_parallel_processors; ++i)
+    // Warming up a batched model locally would run it at the wrong batch size
+    if (m_model->loaded && m_server == nullptr)
     {
-        m_instances.emplace_back (std::make_shared<Instance> (m_inference_config));
+        m_instances.front()->warmUp();
     }
+
+    // The morph model runs locally next to the main one, so it can't go through the server
+    if (! morph_model_file.empty() && m_model->loaded && m_server == nullptr)
+    {
+        m_morph_model = Model::acquire (morph_model_file, load_options);
+
+        if (m_morph_model->loaded)
+        {
+            for (size_t i = 0; i < num_instances; ++i)
+            {
+                m_morph_instances.emplace_back (std::make_shared<Instance> (m_inference_config, m_latent_controls, getInstanceModel (m_morph_model, i)));
+            }
+
+            m_morph_instances.front()->warmUp();
+
+            // Latents can only be mixed frame by frame when both models batch the
+            // channels the same way and compress time by the same ratio
+            m_can_morph_latents = m_instances.front()->latent_buffer.defined() && m_morph_instances.front()->latent_buffer.defined()
+                               && m_model->stereo == m_morph_model->stereo && m_model->getModelRatio() == m_morph_model->getModelRatio();
+        }
+        else
+        {
+            std::cerr << "[WARNING] could not load morph model " << morph_model_file << std::endl;
+            m_morph_model.reset();
+        }
+    }
+    else if (! morph_model_file.empty() && m_server != nullptr)
+    {
+        std::cerr << "[WARNING] morphing is not available with batched inference" << std::endl;
+    }
+
+    m_pool.resize (m_instances.size());
+}
+
+// Streaming exports keep their cached convolutions in module buffers, which every call
+// updates, so instances that may run at the same time can't share a module. The first
+// instance uses the processor's own model, unless that is the batched server's, which
+// its thread runs; every other one gets a clone sharing the weights.
+std::shared_ptr<RAVEProcessor::Model> RAVEProcessor::getInstanceModel (const std::shared_ptr<Model>& model, size_t index) const
+{
+    if (! model->loaded || (index == 0 && model != m_server_model))
+    {
+        return model;
+    }
+
+    return std::make_shared<Model> (model);
 }
 
 RAVEProcessor::~RAVEProcessor()
 {
+    if (m_server != nullptr)
+    {
+        m_server->unregisterClient (m_server_lane);
+    }
 }
 
 void RAVEProcessor::prepare()
@@ -22,48 +263,108 @@ void RAVEProcessor::prepare()
     {
         instance->prepare();
     }
+
+    for (auto& instance : m_morph_instances)
+    {
+        instance->prepare();
+    }
 }
 
 void RAVEProcessor::process (anira::AudioBufferF& input, anira::AudioBufferF& output, std::shared_ptr<anira::SessionElement> session)
 {
-    while (true)
+    // anira's threads are shared by every processor, so the settings are applied by the
+    // threads themselves, the first time they run an inference after a change
+    InferenceThreading::applyToCurrentThread ([] (int threads) { at::set_num_threads (threads); });
+
+    InferenceMonitor::ScopedInference timing (m_monitor);
+    InstancePool::ScopedSlot slot (m_pool);
+
+    // Only both ends of a morph need both models
+    auto morph = m_morph_instances.empty() ? 0.0f : std::clamp (m_latent_controls.morph.load(), 0.0f, 1.0f);
+
+    if (morph <= 0.0f)
     {
-        for (auto& instance : m_instances)
-        {
-            if (! (instance->m_processing.exchange (true)))
-            {
-                instance->process (input, output, session);
-                instance->m_processing.exchange (false);
-                return;
-            }
-        }
+        m_instances[slot.index]->process (input, output, session);
+    }
+    else if (morph >= 1.0f)
+    {
+        m_morph_instances[slot.index]->process (input, output, session);
+    }
+    else
+    {
+        processMorph (*m_instances[slot.index], *m_morph_instances[slot.index], morph, input, output, session);
     }
 }
 
-RAVEProcessor::Instance::Instance (anira::InferenceConfig& inference_config)
-    : m_inference_config (inference_config)
+// Both models run at once, the morph model on torch's inter-op pool, so a morph takes
+// about as long as a single model rather than twice as long
+void RAVEProcessor::processMorph (Instance& main, Instance& morph, float amount, anira::AudioBufferF& input, anira::AudioBufferF& output, const std::shared_ptr<anira::SessionElement>& session)
 {
-    rave_model_file = inference_config.get_model_path (anira::LIBTORCH);
-    try
+    main.readInputs (input, session);
+    morph.readInputs (input, session);
+
+    c10::InferenceMode guard;
+    at::Tensor main_output, morph_output;
+
+    if (m_latent_controls.morphLatents.load() && m_can_morph_latents)
     {
-        m_module = torch::jit::load (m_inference_config.get_model_path (anira::InferenceBackend::LIBTORCH));
+        at::Tensor main_latent, morph_latent;
+        runConcurrently ([&] { main_latent = main.encode (main.getAudioInput()); },
+                         [&] { morph_latent = morph.encode (morph.getAudioInput()); });
+
+        auto latent = torch::lerp (main_latent, fitLatent (morph_latent, main_latent.size (1)), amount);
+        main.nextLatentFrame (latent);
+
+        auto morph_frame = fitLatent (main.latent_frame, morph.latent_frame.size (1));
+        runConcurrently ([&] { main_output = main.decode (main.latent_frame); },
+                         [&] { morph_output = morph.decode (morph_frame); });
     }
-    catch (const c10::Error& e)
+    else
     {
-        std::cerr << "[ERROR] error loading the model\n";
-        std::cerr << e.what() << std::endl;
+        runConcurrently ([&] { main_output = main.inferAudio(); },
+                         [&] { morph_output = morph.inferAudio(); });
     }
-    m_inputs.resize (m_inference_config.m_input_sizes.size());
-    m_input_data.resize (m_inference_config.m_input_sizes.size());
-    for (size_t i = 0; i < m_inference_config.m_input_sizes.size(); i++)
+
+    // Mono and stereo models lay out both channels the same way in memory
+    auto blended = torch::lerp (main_output.contiguous().view (-1), morph_output.contiguous().view (-1), amount);
+    auto num_samples = std::min<size_t> (m_inference_config.m_output_sizes[m_inference_config.m_index_audio_data[anira::Output]], (size_t) blended.numel());
+    std::copy_n (blended.data_ptr<float>(), num_samples, output.get_memory_block().data());
+}
+
+RAVEProcessor::Model::Model (const std::string& model_file, LoadOptions load_options)
+    : rave_model_file (model_file)
+{
+    if (load_options.quantized)
     {
-        m_input_data[i].resize (m_inference_config.m_input_sizes[i]);
-        m_inputs[i] = torch::from_blob (m_input_data[i].data(), m_inference_config.get_input_shape (anira::InferenceBackend::LIBTORCH)[i]);
+        auto quantized_file = getQuantizedPath (model_file);
+
+        if (std::filesystem::exists (quantized_file))
+        {
+            rave_model_file = quantized_file;
+            quantized = true;
+
+            // Dynamically quantized linear layers run on LibTorch's quantized engine, which
+            // is process-wide; its default (the best one this build supports) is left alone
+            if (at::globalContext().supportedQEngines().empty())
+                std::cerr << "[WARNING] this LibTorch build has no quantized engine to run " << quantized_file << std::endl;
+        }
+        else
+        {
+            std::cerr << "[WARNING] no quantized export found at " << quantized_file << ", using the float model" << std::endl;
+        }
     }
 
-    for (size_t i = 0; i < m_inference_config.m_warm_up; i++)
+    try
     {
-        m_outputs = m_module.forward (m_inputs);
+        m_module = loadModule (rave_model_file);
+        m_module.eval();
+        loaded = true;
+    }
+    catch (const c10::Error& e)
+    {
+        std::cerr << "[ERROR] error loading the model\n";
+        std::cerr << e.what() << std::endl;
+        return;
     }
 
     auto named_buffers = m_module.named_buffers();
@@ -170,85 +471,322 @@ RAVEProcessor::Instance::Instance (anira::InferenceConfig& inference_config)
     std::cout << "\tFull latent size: " << getFullLatentDimensions()
               << std::endl;
     std::cout << "\tRatio: " << getModelRatio() << std::endl;
+
+    // The metadata above is read first, since freezing folds attributes into constants
+    if (load_options.optimize)
+    {
+        optimize();
+    }
 }
 
-void RAVEProcessor::Instance::prepare()
+RAVEProcessor::Model::Model (std::shared_ptr<const Model> source)
+    : rave_model_file (source->rave_model_file)
+    , loaded (source->loaded)
+    , optimized (source->optimized)
+    , quantized (source->quantized)
+    , stereo (source->stereo)
+    , has_prior (source->has_prior)
+    , sr (source->sr)
+    , latent_size (source->latent_size)
+    , encode_params (source->encode_params)
+    , decode_params (source->decode_params)
+    , prior_params (source->prior_params)
+    , m_source (source)
 {
-    for (size_t i = 0; i < m_inference_config.m_input_sizes.size(); i++)
+    if (! loaded)
     {
-        m_input_data[i].clear();
+        return;
+    }
+
+    c10::InferenceMode guard;
+
+    // An in-place clone has module objects of its own around the same tensors
+    m_module = source->m_module.clone (true);
+
+    std::unordered_set<const c10::TensorImpl*> weights;
+
+    for (const auto& parameter : m_module.named_parameters (true))
+    {
+        weights.insert (parameter.value.unsafeGetTensorImpl());
+    }
+
+    for (const auto& attribute : m_module.named_attributes (true))
+    {
+        if (attribute.value.isTensor() && weights.count (attribute.value.toTensor().unsafeGetTensorImpl()) == 0)
+        {
+            setNestedAttribute (m_module, attribute.name, attribute.value.toTensor().clone());
+        }
     }
 }
 
-void RAVEProcessor::Instance::process (anira::AudioBufferF& input, anira::AudioBufferF& output, std::shared_ptr<anira::SessionElement> session)
+std::shared_ptr<RAVEProcessor::Model> RAVEProcessor::Model::acquire (const std::string& model_file, LoadOptions load_options)
 {
-    for (size_t i = 0; i < m_inference_config.m_input_sizes.size(); i++)
+    static std::mutex cache_mutex;
+    static std::map<std::string, std::weak_ptr<const Model>> cache;
+
+    std::error_code error;
+    auto modified = std::filesystem::last_write_time (model_file, error);
+    auto key = model_file + "|" + std::to_string (error ? 0 : modified.time_since_epoch().count())
+             + (load_options.optimize ? "|optimized" : "") + (load_options.quantized ? "|int8" : "");
+
+    std::shared_ptr<const Model> source;
+
     {
-        if (i != m_inference_config.m_index_audio_data[anira::Input])
+        // Held while loading, so that instances opening together wait for one load
+        std::lock_guard<std::mutex> lock (cache_mutex);
+        std::erase_if (cache, [] (const auto& entry) { return entry.second.expired(); });
+
+        source = cache[key].lock();
+
+        if (source == nullptr)
         {
-            for (size_t j = 0; j < m_input_data[i].size(); j++)
+            source = std::make_shared<const Model> (model_file, load_options);
+
+            if (source->loaded)
             {
-                m_input_data[i][j] = session->m_pp_processor.get_input (i, j);
+                cache[key] = source;
             }
         }
-        else
+    }
+
+    return std::make_shared<Model> (source);
+}
+
+std::string RAVEProcessor::Model::getQuantizedPath (const std::string& model_file)
+{
+    auto path = std::filesystem::path (model_file);
+    return (path.parent_path() / (path.stem().string() + "_int8" + path.extension().string())).string();
+}
+
+void RAVEProcessor::Model::optimize()
+{
+    // Methods other than forward are dropped by freezing unless they are preserved
+    std::vector<std::string> methods;
+
+    for (auto* name : { "encode", "decode", "encode_amortized", "prior" })
+    {
+        if (hasMethod (name))
         {
-            m_input_data[i].swap_data (input.get_memory_block());
-            input.reset_channel_ptr();
+            methods.emplace_back (name);
         }
-        // This is necessary because the tensor data pointers seem to change from inference to inference
-        m_inputs[i] = torch::from_blob (m_input_data[i].data(), m_inference_config.get_input_shape (anira::InferenceBackend::LIBTORCH)[i]);
+    }
+
+    try
+    {
+        // Both passes rewrite this module's graphs only; the graph executor settings are
+        // process-wide and so left as they are for every other model in the host
+        auto frozen = torch::jit::freeze (m_module, methods);
+        m_module = torch::jit::optimize_for_inference (frozen, methods);
+        optimized = true;
+
+        std::cout << "\tFrozen and optimized for inference" << std::endl;
+    }
+    catch (const c10::Error& e)
+    {
+        // Some exports can't be frozen (e.g. they mutate attributes in a way the pass
+        // rejects); they still run, just without the optimisations
+        std::cerr << "[WARNING] could not optimize " << rave_model_file << ": " << e.what() << std::endl;
+    }
+}
+
+RAVEProcessor::Instance::Instance (anira::InferenceConfig& inference_config, const LatentControls& latent_controls, std::shared_ptr<Model> model)
+    : m_model (std::move (model))
+    , m_module (m_model->m_module)
+    , m_inference_config (inference_config)
+    , m_latent_controls (latent_controls)
+{
+    m_inputs.resize (m_inference_config.m_input_sizes.size());
+    m_input_data.resize (m_inference_config.m_input_sizes.size());
+    for (size_t i = 0; i < m_inference_config.m_input_sizes.size(); i++)
+    {
+        m_input_data[i].resize (m_inference_config.m_input_sizes[i]);
+    }
+
+    bindInputs();
+
+    inputs_rave.resize (1);
+
+    // Probe the latent shape produced by the configured input shape, so that the
+    // latent history used by the split encode/decode mode is allocated once here
+    if (m_model->loaded && m_model->hasMethod ("encode") && m_model->hasMethod ("decode"))
+    {
+        allocateLatentBuffer (encode (m_inputs[m_inference_config.m_index_audio_data[anira::Input]].toTensor()));
+    }
+}
+
+void RAVEProcessor::Instance::warmUp()
+{
+    for (size_t i = 0; i < m_inference_config.m_warm_up; i++)
+    {
+        m_outputs = m_module.forward (m_inputs);
+    }
+}
+
+void RAVEProcessor::Instance::prepare()
+{
+    for (size_t i = 0; i < m_inference_config.m_input_sizes.size(); i++)
+    {
+        m_input_data[i].clear();
+    }
+
+    if (latent_buffer.defined())
+    {
+        resetLatentBuffer();
+    }
+
+    bindInputs();
+}
+
+// The input tensors wrap this instance's own input storage, which never moves, so they
+// are created once here rather than on every inference
+void RAVEProcessor::Instance::bindInputs()
+{
+    for (size_t i = 0; i < m_inference_config.m_input_sizes.size(); i++)
+    {
+        m_inputs[i] = torch::from_blob (m_input_data[i].data(), getInputShape (i));
+    }
+}
+
+void RAVEProcessor::Instance::process (anira::AudioBufferF& input, anira::AudioBufferF& output, std::shared_ptr<anira::SessionElement> session)
+{
+    readInputs (input, session);
+
+    if (m_latent_controls.splitEncodeDecode.load() && latent_buffer.defined())
+    {
+        processEncodeDecode (output);
+        return;
+    }
+
+    if (m_server != nullptr)
+    {
+        auto audio_input = m_inference_config.m_index_audio_data[anira::Input];
+        auto audio_output = m_inference_config.m_index_audio_data[anira::Output];
+        auto* output_data = output.get_memory_block().data();
+
+        if (! m_server->infer (m_server_lane, m_input_data[audio_input].data(), output_data, m_inference_config.m_output_sizes[audio_output]))
+        {
+            std::fill_n (output_data, m_inference_config.m_output_sizes[audio_output], 0.0f);
+        }
+
+        return;
     }
 
     // Run inference
     m_outputs = m_module.forward (m_inputs);
 
-    // We need to copy the data because we cannot access the data pointer ref of the tensor directly
-    if (m_outputs.isTuple())
+    // We need to copy the data because we cannot access the data pointer ref of the tensor directly,
+    // but each output is resolved once and copied in bulk rather than element by element
+    for (size_t i = 0; i < m_inference_config.m_output_sizes.size(); i++)
     {
-        for (size_t i = 0; i < m_inference_config.m_output_sizes.size(); i++)
+        auto tensor = getOutputTensor (i);
+
+        if (! tensor.defined())
         {
-            if (i != m_inference_config.m_index_audio_data[anira::Output])
-            {
-                for (size_t j = 0; j < m_inference_config.m_output_sizes[i]; j++)
-                {
-                    session->m_pp_processor.set_output (m_outputs.toTuple()->elements()[i].toTensor().view ({ -1 }).data_ptr<float>()[j], i, j);
-                }
-            }
-            else
+            continue;
+        }
+
+        tensor = tensor.contiguous();
+        const auto* data = tensor.data_ptr<float>();
+        auto num_samples = std::min<size_t> (m_inference_config.m_output_sizes[i], (size_t) tensor.numel());
+
+        if (i != m_inference_config.m_index_audio_data[anira::Output])
+        {
+            for (size_t j = 0; j < num_samples; j++)
             {
-                for (size_t j = 0; j < m_inference_config.m_output_sizes[i]; j++)
-                {
-                    output.get_memory_block()[j] = m_outputs.toTuple()->elements()[i].toTensor().view ({ -1 }).data_ptr<float>()[j];
-                }
+                session->m_pp_processor.set_output (data[j], i, j);
             }
         }
+        else
+        {
+            std::copy_n (data, num_samples, output.get_memory_block().data());
+        }
     }
-    else if (m_outputs.isTensorList())
+}
+
+void RAVEProcessor::Instance::readInputs (anira::AudioBufferF& input, const std::shared_ptr<anira::SessionElement>& session)
+{
+    // Inputs are copied into the storage the tensors were bound to, rather than swapped
+    // in, so that the tensors stay valid from one inference to the next. Non-audio inputs
+    // are copied in bulk from a RAVEPrePostProcessor, and only read element by element
+    // from any other PrePostProcessor.
+    auto* inputs = session != nullptr ? dynamic_cast<const RAVEPrePostProcessor*> (&session->m_pp_processor) : nullptr;
+
+    for (size_t i = 0; i < m_inference_config.m_input_sizes.size(); i++)
     {
-        for (size_t i = 0; i < m_inference_config.m_output_sizes.size(); i++)
+        if (i == m_inference_config.m_index_audio_data[anira::Input])
         {
-            if (i != m_inference_config.m_index_audio_data[anira::Output])
-            {
-                for (size_t j = 0; j < m_inference_config.m_output_sizes[i]; j++)
-                {
-                    session->m_pp_processor.set_output (m_outputs.toTensorList().get (i).view ({ -1 }).data_ptr<float>()[j], i, j);
-                }
-            }
-            else
+            std::copy_n (input.get_memory_block().data(), std::min (input.get_memory_block().size(), m_input_data[i].size()), m_input_data[i].data());
+        }
+        else if (inputs != nullptr)
+        {
+            inputs->readInput (i, m_input_data[i].data(), m_input_data[i].size());
+        }
+        else if (session != nullptr)
+        {
+            for (size_t j = 0; j < m_input_data[i].size(); j++)
             {
-                for (size_t j = 0; j < m_inference_config.m_output_sizes[i]; j++)
-                {
-                    output.get_memory_block()[j] = m_outputs.toTensorList().get (i).view ({ -1 }).data_ptr<float>()[j];
-                }
+                m_input_data[i][j] = session->m_pp_processor.get_input (i, j);
             }
         }
     }
-    else if (m_outputs.isTensor())
+}
+
+// The audio output of whichever mode is selected, for blending with another instance's
+at::Tensor RAVEProcessor::Instance::inferAudio()
+{
+    if (m_latent_controls.splitEncodeDecode.load() && latent_buffer.defined())
     {
-        for (size_t i = 0; i < m_inference_config.m_output_sizes[0]; i++)
-        {
-            output.get_memory_block()[i] = m_outputs.toTensor().view ({ -1 }).data_ptr<float>()[i];
-        }
+        return encodeDecode();
+    }
+
+    m_outputs = m_module.forward (m_inputs);
+    return getOutputTensor (m_inference_config.m_index_audio_data[anira::Output]);
+}
+
+at::Tensor RAVEProcessor::Instance::getOutputTensor (size_t index)
+{
+    if (m_outputs.isTuple())
+    {
+        return m_outputs.toTuple()->elements()[index].toTensor();
+    }
+
+    if (m_outputs.isTensorList())
+    {
+        return m_outputs.toTensorList().get (index);
     }
+
+    if (m_outputs.isTensor() && index == m_inference_config.m_index_audio_data[anira::Output])
+    {
+        return m_outputs.toTensor();
+    }
+
+    return {};
+}
+
+void RAVEProcessor::Instance::processEncodeDecode (anira::AudioBufferF& output)
+{
+    auto decoded = encodeDecode().contiguous();
+    auto num_samples = std::min<size_t> (m_inference_config.m_output_sizes[m_inference_config.m_index_audio_data[anira::Output]], (size_t) decoded.numel());
+    std::copy_n (decoded.data_ptr<float>(), num_samples, output.get_memory_block().data());
+}
+
+at::Tensor RAVEProcessor::Instance::encodeDecode()
+{
+    c10::InferenceMode guard;
+
+    auto latent = encode (m_inputs[m_inference_config.m_index_audio_data[anira::Input]].toTensor());
+    return decode (nextLatentFrame (latent));
+}
+
+std::vector<int64_t> RAVEProcessor::Instance::getInputShape (size_t index) const
+{
+    auto shape = m_inference_config.get_input_shape (anira::InferenceBackend::LIBTORCH)[index];
+
+    // Channels are batched for mono models; a stereo model takes them as its own channels
+    if (m_model->stereo && index == m_inference_config.m_index_audio_data[anira::Input] && shape.size() == 3)
+    {
+        shape = { 1, shape[0] * shape[1], shape[2] };
+    }
+
+    return shape;
 }
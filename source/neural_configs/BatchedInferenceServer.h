@@ -0,0 +1,86 @@
+#pragma once
+
+#include "./RAVE.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Process-wide service that runs the inferences of every plugin instance using the
+// same model as one batched forward call.
+//
+// Each RAVEProcessor that opts in registers as a client and gets a lane, whichever of
+// its instances runs the block: blocks of one processor go through its lane one at a
+// time and in order, so they stream through a single batch entry's convolution cache.
+//
+// A tick's batch is made of the lanes that have submitted a block, in lane order, and
+// is run as soon as every lane that was in the previous batch is back (or max_wait after
+// the first one arrived). Idle lanes, e.g. of silence-gated processors, are neither
+// waited for nor run. While the same processors keep playing, every lane keeps its batch
+// position from tick to tick; when one starts or stops, the batch size changes and the
+// caches of the streaming models restart.
+//
+// If forward throws, every lane in that batch gets silence back and the server carries
+// on with the next tick.
+class BatchedInferenceServer
+{
+public:
+    // One server per model file, block shape and load options, shared by every
+    // processor that asks for the same combination
+    static std::shared_ptr<BatchedInferenceServer> get (const std::string& model_file,
+                                                        RAVEProcessor::LoadOptions load_options,
+                                                        const std::vector<int64_t>& block_shape);
+
+    BatchedInferenceServer (const std::string& model_file, RAVEProcessor::LoadOptions load_options, const std::vector<int64_t>& block_shape);
+    ~BatchedInferenceServer();
+
+    std::shared_ptr<RAVEProcessor::Model> getModel() const { return m_model; }
+
+    size_t registerClient();
+    void unregisterClient (size_t lane);
+
+    // Runs one block in the client's lane and blocks until the batch it is part of
+    // has been processed. Returns false, leaving output untouched, if the server is
+    // shutting down or the batch failed.
+    bool infer (size_t lane, const float* input, float* output, size_t num_output_samples);
+
+    size_t getNumClients() const;
+
+    // How long the server waits for the rest of the lanes once the first one arrived
+    static constexpr std::chrono::microseconds max_wait { 2000 };
+
+private:
+    struct Lane
+    {
+        bool active = false; // registered to a client
+        bool playing = false; // in the last batch, so waited for in the next one
+        bool submitted = false;
+        bool done = false;
+        bool in_batch = false; // submitted before the running batch was gathered
+        bool failed = false;   // the batch it was in threw
+        std::vector<float> input;
+        std::vector<float> output;
+    };
+
+    void run();
+    bool allPlayingLanesSubmitted() const;
+
+    std::shared_ptr<RAVEProcessor::Model> m_model;
+
+    // Shape of one lane's block, and its number of values
+    std::vector<int64_t> m_lane_shape;
+    size_t m_lane_size = 1;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_server_cv, m_client_cv;
+    std::vector<Lane> m_lanes;
+    std::chrono::steady_clock::time_point m_tick_start;
+    bool m_stopping = false;
+
+    std::thread m_thread;
+};
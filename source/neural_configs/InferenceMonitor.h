@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+// Lock-free instrumentation for a backend's inference calls.
+//
+// Durations go into a histogram of power-of-two microsecond buckets, so recording
+// one is a couple of relaxed atomic adds and any thread can read a snapshot while
+// inferences keep running. An inference that takes longer than the deadline (anira's
+// maximum inference time) is counted as missed: anira has stopped waiting for it, and
+// the wet signal falls back to stale or silent samples. One that takes longer than
+// the audio duration of a model block is counted as over the block: no dropout by
+// itself, but a backend that keeps doing so can't keep up with the stream.
+class InferenceMonitor
+{
+public:
+    // Bucket i holds durations in [2^(i-1), 2^i) * bucket_base_us, the first one
+    // everything below bucket_base_us and the last one everything above.
+    static constexpr size_t num_buckets = 16;
+    static constexpr uint64_t bucket_base_us = 64;
+
+    struct Snapshot
+    {
+        uint64_t count = 0;
+        uint64_t missed = 0;
+        uint64_t over_block = 0;
+        uint64_t total_us = 0;
+        uint64_t max_us = 0;
+        uint64_t deadline_us = 0;
+        uint64_t block_us = 0;
+        size_t in_flight = 0;     // inferences running or waiting for an instance right now
+        size_t max_in_flight = 0; // the most that were ever queued up at once
+        std::array<uint64_t, num_buckets> histogram {};
+
+        double getMeanMs() const { return count > 0 ? (double) total_us / (double) count / 1000.0 : 0.0; }
+
+        double getMaxMs() const { return (double) max_us / 1000.0; }
+
+        // Upper bound of the bucket that contains the given fraction of all inferences
+        double getPercentileMs (double fraction) const
+        {
+            auto target = (uint64_t) std::ceil ((double) count * fraction);
+            uint64_t seen = 0;
+
+            for (size_t i = 0; i < num_buckets; ++i)
+            {
+                seen += histogram[i];
+
+                if (seen >= target && seen > 0)
+                    return (double) (bucket_base_us << i) / 1000.0;
+            }
+
+            return getMaxMs();
+        }
+    };
+
+    class ScopedInference
+    {
+    public:
+        explicit ScopedInference (InferenceMonitor& m)
+            : monitor (m)
+            , start (std::chrono::steady_clock::now())
+        {
+            monitor.enter();
+        }
+
+        ~ScopedInference()
+        {
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds> (std::chrono::steady_clock::now() - start);
+            monitor.exit ((uint64_t) elapsed.count());
+        }
+
+    private:
+        InferenceMonitor& monitor;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    void setDeadline (double seconds) { m_deadline_us.store ((uint64_t) (seconds * 1.0e6)); }
+
+    void setBlockDuration (double seconds) { m_block_us.store ((uint64_t) (seconds * 1.0e6)); }
+
+    Snapshot getSnapshot() const
+    {
+        Snapshot snapshot;
+        snapshot.count = m_count.load (std::memory_order_relaxed);
+        snapshot.missed = m_missed.load (std::memory_order_relaxed);
+        snapshot.over_block = m_over_block.load (std::memory_order_relaxed);
+        snapshot.total_us = m_total_us.load (std::memory_order_relaxed);
+        snapshot.max_us = m_max_us.load (std::memory_order_relaxed);
+        snapshot.deadline_us = m_deadline_us.load (std::memory_order_relaxed);
+        snapshot.block_us = m_block_us.load (std::memory_order_relaxed);
+        snapshot.in_flight = m_in_flight.load (std::memory_order_relaxed);
+        snapshot.max_in_flight = m_max_in_flight.load (std::memory_order_relaxed);
+
+        for (size_t i = 0; i < num_buckets; ++i)
+            snapshot.histogram[i] = m_histogram[i].load (std::memory_order_relaxed);
+
+        return snapshot;
+    }
+
+    void reset()
+    {
+        m_count.store (0);
+        m_missed.store (0);
+        m_over_block.store (0);
+        m_total_us.store (0);
+        m_max_us.store (0);
+        m_max_in_flight.store (m_in_flight.load());
+
+        for (auto& bucket : m_histogram)
+            bucket.store (0);
+    }
+
+private:
+    void enter()
+    {
+        auto depth = m_in_flight.fetch_add (1, std::memory_order_relaxed) + 1;
+        auto max_depth = m_max_in_flight.load (std::memory_order_relaxed);
+
+        while (depth > max_depth && ! m_max_in_flight.compare_exchange_weak (max_depth, depth, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void exit (uint64_t duration_us)
+    {
+        m_in_flight.fetch_sub (1, std::memory_order_relaxed);
+
+        auto bucket = std::min<size_t> ((size_t) std::bit_width (duration_us / bucket_base_us), num_buckets - 1);
+        m_histogram[bucket].fetch_add (1, std::memory_order_relaxed);
+        m_count.fetch_add (1, std::memory_order_relaxed);
+        m_total_us.fetch_add (duration_us, std::memory_order_relaxed);
+
+        auto deadline = m_deadline_us.load (std::memory_order_relaxed);
+
+        if (deadline > 0 && duration_us > deadline)
+            m_missed.fetch_add (1, std::memory_order_relaxed);
+
+        auto block = m_block_us.load (std::memory_order_relaxed);
+
+        if (block > 0 && duration_us > block)
+            m_over_block.fetch_add (1, std::memory_order_relaxed);
+
+        auto max_us = m_max_us.load (std::memory_order_relaxed);
+
+        while (duration_us > max_us && ! m_max_us.compare_exchange_weak (max_us, duration_us, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    std::atomic<uint64_t> m_count { 0 }, m_missed { 0 }, m_over_block { 0 }, m_total_us { 0 }, m_max_us { 0 }, m_deadline_us { 0 }, m_block_us { 0 };
+    std::atomic<size_t> m_in_flight { 0 }, m_max_in_flight { 0 };
+    std::array<std::atomic<uint64_t>, num_buckets> m_histogram {};
+};
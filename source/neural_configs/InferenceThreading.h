@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// How inference work is spread over the machine.
+//
+// anira runs every plugin instance's inferences on one process-wide pool of threads,
+// so these settings are process-wide too. The pool size is read when anira creates its
+// context, i.e. when the first InferenceHandler is made; the per-thread settings are
+// applied lazily by each inference thread the next time it runs a RAVEProcessor after
+// they changed.
+struct InferenceThreadingOptions
+{
+    // anira inference threads; 0 keeps anira's default (half the hardware threads)
+    unsigned int num_inference_threads = 0;
+
+    // Instances per RAVEProcessor, i.e. how many of its inferences can run at once;
+    // 0 keeps InferenceConfig::m_num_parallel_processors
+    unsigned int num_parallel_processors = 0;
+
+    // LibTorch intra-op threads used by each inference
+    int intra_op_threads = 1;
+
+    // Cores the inference threads may run on; empty for any core (Linux only)
+    std::vector<int> cpu_affinity;
+
+    // SCHED_FIFO priority for the inference threads, 1-99, or 0 to leave their scheduling
+    // as it is (Linux only, needs CAP_SYS_NICE or an rtprio limit)
+    int realtime_priority = 0;
+};
+
+class InferenceThreading
+{
+public:
+    static void set (const InferenceThreadingOptions& options)
+    {
+        std::lock_guard<std::mutex> lock (getMutex());
+        getStorage() = options;
+        getGeneration().fetch_add (1);
+    }
+
+    static InferenceThreadingOptions get()
+    {
+        std::lock_guard<std::mutex> lock (getMutex());
+        return getStorage();
+    }
+
+    static unsigned int getNumInferenceThreads()
+    {
+        auto threads = get().num_inference_threads;
+        return threads > 0 ? threads : std::max (1u, std::thread::hardware_concurrency() / 2);
+    }
+
+    // Cheap when nothing changed: one relaxed load and a thread_local compare
+    template <typename SetIntraOpThreads>
+    static void applyToCurrentThread (SetIntraOpThreads&& set_intra_op_threads)
+    {
+        thread_local uint64_t applied_generation = 0;
+        auto generation = getGeneration().load (std::memory_order_relaxed);
+
+        if (generation == applied_generation)
+            return;
+
+        applied_generation = generation;
+        auto options = get();
+        set_intra_op_threads (std::max (1, options.intra_op_threads));
+
+#if defined(__linux__)
+        // The thread's own affinity and scheduling (whatever anira or the host gave it) are
+        // only replaced by an explicit setting, and put back once that setting is cleared
+        thread_local bool changed_affinity = false, changed_priority = false;
+        thread_local cpu_set_t original_affinity;
+        thread_local int original_policy = SCHED_OTHER;
+        thread_local sched_param original_param {};
+
+        if (! options.cpu_affinity.empty())
+        {
+            if (! changed_affinity)
+                changed_affinity = pthread_getaffinity_np (pthread_self(), sizeof (original_affinity), &original_affinity) == 0;
+
+            cpu_set_t set;
+            CPU_ZERO (&set);
+
+            for (auto cpu : options.cpu_affinity)
+                CPU_SET (cpu, &set);
+
+            if (pthread_setaffinity_np (pthread_self(), sizeof (set), &set) != 0)
+                std::cerr << "[WARNING] could not set the inference thread affinity" << std::endl;
+        }
+        else if (changed_affinity)
+        {
+            pthread_setaffinity_np (pthread_self(), sizeof (original_affinity), &original_affinity);
+            changed_affinity = false;
+        }
+
+        if (options.realtime_priority > 0)
+        {
+            if (! changed_priority)
+                changed_priority = pthread_getschedparam (pthread_self(), &original_policy, &original_param) == 0;
+
+            sched_param param {};
+            param.sched_priority = options.realtime_priority;
+
+            if (pthread_setschedparam (pthread_self(), SCHED_FIFO, &param) != 0)
+                std::cerr << "[WARNING] could not set the inference thread priority to " << options.realtime_priority << std::endl;
+        }
+        else if (changed_priority)
+        {
+            pthread_setschedparam (pthread_self(), original_policy, &original_param);
+            changed_priority = false;
+        }
+#endif
+    }
+
+private:
+    static std::mutex& getMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static InferenceThreadingOptions& getStorage()
+    {
+        static InferenceThreadingOptions options;
+        return options;
+    }
+
+    // Starts at 1 so that every thread applies the settings once, defaults included
+    static std::atomic<uint64_t>& getGeneration()
+    {
+        static std::atomic<uint64_t> generation { 1 };
+        return generation;
+    }
+};
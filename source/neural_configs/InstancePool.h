@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+// Pool of up to 64 interchangeable slots, handed out by index.
+//
+// The free list is a single atomic bit mask, so acquiring a free slot is one
+// compare-exchange and releasing one is a single fetch_or. When every slot is
+// busy, a caller yields for a few rounds and then blocks on the mask until a
+// release wakes it up, rather than spinning on a core.
+class InstancePool
+{
+public:
+    static constexpr size_t max_size = 64;
+
+    struct Stats
+    {
+        uint64_t acquisitions = 0; // total number of acquire() calls
+        uint64_t contentions = 0;  // acquire() calls that found no free slot at first
+        uint64_t waits = 0;        // times a caller had to block until a release
+    };
+
+    explicit InstancePool (size_t size = 0, int spin_rounds = 16)
+        : m_spin_rounds (spin_rounds)
+    {
+        resize (size);
+    }
+
+    // Not thread-safe: only call while no slot is in use.
+    void resize (size_t size)
+    {
+        assert (size <= max_size);
+        m_size = std::min (size, max_size);
+        m_free_mask.store (m_size == max_size ? ~uint64_t (0) : (uint64_t (1) << m_size) - 1);
+    }
+
+    size_t size() const { return m_size; }
+
+    size_t acquire()
+    {
+        m_acquisitions.fetch_add (1, std::memory_order_relaxed);
+
+        for (int round = 0;; ++round)
+        {
+            auto mask = m_free_mask.load (std::memory_order_acquire);
+
+            while (mask != 0)
+            {
+                auto index = (size_t) std::countr_zero (mask);
+
+                if (m_free_mask.compare_exchange_weak (mask, mask & ~(uint64_t (1) << index), std::memory_order_acquire, std::memory_order_relaxed))
+                {
+                    return index;
+                }
+            }
+
+            if (round == 0)
+            {
+                m_contentions.fetch_add (1, std::memory_order_relaxed);
+            }
+
+            if (round < m_spin_rounds)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                m_waits.fetch_add (1, std::memory_order_relaxed);
+                m_free_mask.wait (0, std::memory_order_acquire);
+            }
+        }
+    }
+
+    void release (size_t index)
+    {
+        assert (index < m_size);
+        m_free_mask.fetch_or (uint64_t (1) << index, std::memory_order_release);
+        m_free_mask.notify_one();
+    }
+
+    size_t getNumInUse() const
+    {
+        return m_size - (size_t) std::popcount (m_free_mask.load (std::memory_order_relaxed));
+    }
+
+    Stats getStats() const
+    {
+        return { m_acquisitions.load (std::memory_order_relaxed),
+                 m_contentions.load (std::memory_order_relaxed),
+                 m_waits.load (std::memory_order_relaxed) };
+    }
+
+    void resetStats()
+    {
+        m_acquisitions.store (0);
+        m_contentions.store (0);
+        m_waits.store (0);
+    }
+
+    // Holds a slot for the lifetime of the object
+    struct ScopedSlot
+    {
+        explicit ScopedSlot (InstancePool& p)
+            : pool (p)
+            , index (p.acquire())
+        {
+        }
+
+        ~ScopedSlot() { pool.release (index); }
+
+        InstancePool& pool;
+        const size_t index;
+    };
+
+private:
+    size_t m_size = 0;
+    int m_spin_rounds;
+    std::atomic<uint64_t> m_free_mask { 0 };
+    std::atomic<uint64_t> m_acquisitions { 0 }, m_contentions { 0 }, m_waits { 0 };
+};
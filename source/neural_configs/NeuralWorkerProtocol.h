@@ -0,0 +1,291 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define NEURAL_WORKER_SUPPORTED 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define NEURAL_WORKER_SUPPORTED 0
+#endif
+
+// Shared-memory layout between NeuralProcessor and the out-of-process NeuralWorker.
+//
+// The segment starts with a WorkerSharedState header, followed by two single-producer,
+// single-consumer audio rings: one carrying the dry signal to the worker and one carrying
+// the wet signal back. Positions are free-running 64-bit counters in lock-free atomics,
+// which are address-free and so work across the two processes; neither side ever takes
+// a lock or makes a system call to exchange audio.
+namespace neural_worker
+{
+static constexpr uint32_t magic = 0x4e574b52; // "NWKR"
+static constexpr uint32_t version = 1;
+
+static_assert (std::atomic<uint64_t>::is_always_lock_free, "shared-memory rings need address-free atomics");
+
+struct WorkerSharedState
+{
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    uint32_t num_channels = 0;
+    uint32_t ring_capacity = 0; // samples per channel, in each direction
+
+    std::atomic<uint32_t> ready { 0 };          // set by the worker once the model is loaded and warmed up
+    std::atomic<uint32_t> failed { 0 };         // set by the worker if it can't run the model
+    std::atomic<uint32_t> stop_requested { 0 }; // set by the plugin to shut the worker down
+    std::atomic<int32_t> latency { 0 };         // total latency of the worker, in samples
+    std::atomic<uint64_t> heartbeat { 0 };      // bumped by the worker on every loop
+};
+
+// Planar float ring living in shared memory. Only the producer moves write_position
+// and only the consumer moves read_position.
+class SharedAudioRing
+{
+public:
+    struct Header
+    {
+        std::atomic<uint64_t> write_position { 0 };
+        std::atomic<uint64_t> read_position { 0 };
+    };
+
+    static size_t getRequiredBytes (uint32_t capacity, uint32_t num_channels)
+    {
+        return sizeof (Header) + sizeof (float) * (size_t) capacity * num_channels;
+    }
+
+    SharedAudioRing() = default;
+
+    SharedAudioRing (void* memory, uint32_t capacity, uint32_t num_channels, bool initialise)
+        : m_header (static_cast<Header*> (memory))
+        , m_samples (reinterpret_cast<float*> (static_cast<char*> (memory) + sizeof (Header)))
+        , m_capacity (capacity)
+        , m_num_channels (num_channels)
+    {
+        if (initialise)
+        {
+            new (m_header) Header();
+            std::memset (m_samples, 0, sizeof (float) * (size_t) capacity * num_channels);
+        }
+    }
+
+    size_t getNumReady() const
+    {
+        return (size_t) (m_header->write_position.load (std::memory_order_acquire) - m_header->read_position.load (std::memory_order_relaxed));
+    }
+
+    size_t getFreeSpace() const
+    {
+        return m_capacity - (size_t) (m_header->write_position.load (std::memory_order_relaxed) - m_header->read_position.load (std::memory_order_acquire));
+    }
+
+    // Writes all num_samples or nothing
+    bool write (const float* const* channels, size_t num_samples)
+    {
+        if (getFreeSpace() < num_samples)
+            return false;
+
+        auto position = m_header->write_position.load (std::memory_order_relaxed);
+        copy (position, num_samples, [&] (size_t channel, size_t ring_index, size_t offset, size_t count)
+              { std::copy_n (channels[channel] + offset, count, channelData (channel) + ring_index); });
+        m_header->write_position.store (position + num_samples, std::memory_order_release);
+        return true;
+    }
+
+    // Reads all num_samples or nothing
+    bool read (float* const* channels, size_t num_samples)
+    {
+        if (getNumReady() < num_samples)
+            return false;
+
+        auto position = m_header->read_position.load (std::memory_order_relaxed);
+        copy (position, num_samples, [&] (size_t channel, size_t ring_index, size_t offset, size_t count)
+              { std::copy_n (channelData (channel) + ring_index, count, channels[channel] + offset); });
+        m_header->read_position.store (position + num_samples, std::memory_order_release);
+        return true;
+    }
+
+    // Drops up to num_samples without reading them and returns how many were dropped
+    size_t skip (size_t num_samples)
+    {
+        auto count = std::min (num_samples, getNumReady());
+        m_header->read_position.fetch_add (count, std::memory_order_release);
+        return count;
+    }
+
+private:
+    float* channelData (size_t channel) const { return m_samples + channel * m_capacity; }
+
+    template <typename CopyFunction>
+    void copy (uint64_t position, size_t num_samples, CopyFunction&& copy_function)
+    {
+        auto start = (size_t) (position % m_capacity);
+        auto first = std::min (num_samples, (size_t) m_capacity - start);
+
+        for (size_t channel = 0; channel < m_num_channels; ++channel)
+        {
+            copy_function (channel, start, 0, first);
+
+            if (first < num_samples)
+                copy_function (channel, 0, first, num_samples - first);
+        }
+    }
+
+    Header* m_header = nullptr;
+    float* m_samples = nullptr;
+    uint32_t m_capacity = 0;
+    uint32_t m_num_channels = 0;
+};
+
+// The mapped segment: the header and both rings. The plugin creates (and finally
+// unlinks) it; the worker opens it by name.
+class SharedChannel
+{
+public:
+    SharedChannel() = default;
+    SharedChannel (const SharedChannel&) = delete;
+    SharedChannel& operator= (const SharedChannel&) = delete;
+
+    ~SharedChannel() { close(); }
+
+    static size_t getRequiredBytes (uint32_t capacity, uint32_t num_channels)
+    {
+        return alignUp (sizeof (WorkerSharedState)) + 2 * alignUp (SharedAudioRing::getRequiredBytes (capacity, num_channels));
+    }
+
+    bool create (const std::string& name, uint32_t capacity, uint32_t num_channels)
+    {
+#if NEURAL_WORKER_SUPPORTED
+        auto fd = ::shm_open (name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+
+        if (fd < 0)
+            return false;
+
+        m_size = getRequiredBytes (capacity, num_channels);
+
+        if (::ftruncate (fd, (off_t) m_size) != 0 || ! map (fd))
+        {
+            ::close (fd);
+            ::shm_unlink (name.c_str());
+            return false;
+        }
+
+        ::close (fd);
+        m_name = name;
+        m_owner = true;
+
+        auto* state = new (m_memory) WorkerSharedState();
+        state->num_channels = num_channels;
+        state->ring_capacity = capacity;
+        bindRings (true);
+
+        state->version = version;
+        std::atomic_thread_fence (std::memory_order_release);
+        state->magic = magic;
+        return true;
+#else
+        (void) name, (void) capacity, (void) num_channels;
+        return false;
+#endif
+    }
+
+    bool open (const std::string& name)
+    {
+#if NEURAL_WORKER_SUPPORTED
+        auto fd = ::shm_open (name.c_str(), O_RDWR, 0600);
+
+        if (fd < 0)
+            return false;
+
+        struct stat info;
+
+        if (::fstat (fd, &info) != 0 || (size_t) info.st_size < sizeof (WorkerSharedState))
+        {
+            ::close (fd);
+            return false;
+        }
+
+        m_size = (size_t) info.st_size;
+        auto mapped = map (fd);
+        ::close (fd);
+
+        if (! mapped || getState().magic != magic || getState().version != version
+            || m_size < getRequiredBytes (getState().ring_capacity, getState().num_channels))
+        {
+            close();
+            return false;
+        }
+
+        m_name = name;
+        bindRings (false);
+        return true;
+#else
+        (void) name;
+        return false;
+#endif
+    }
+
+    void close()
+    {
+#if NEURAL_WORKER_SUPPORTED
+        if (m_memory != nullptr)
+            ::munmap (m_memory, m_size);
+
+        if (m_owner)
+            ::shm_unlink (m_name.c_str());
+#endif
+        m_memory = nullptr;
+        m_owner = false;
+    }
+
+    bool isOpen() const { return m_memory != nullptr; }
+
+    WorkerSharedState& getState() const { return *static_cast<WorkerSharedState*> (m_memory); }
+
+    SharedAudioRing& getToWorker() { return m_to_worker; }
+
+    SharedAudioRing& getFromWorker() { return m_from_worker; }
+
+    const std::string& getName() const { return m_name; }
+
+private:
+    static size_t alignUp (size_t size) { return (size + 63) & ~(size_t) 63; }
+
+#if NEURAL_WORKER_SUPPORTED
+    bool map (int fd)
+    {
+        auto* memory = ::mmap (nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (memory == MAP_FAILED)
+            return false;
+
+        m_memory = memory;
+        return true;
+    }
+#endif
+
+    void bindRings (bool initialise)
+    {
+        auto capacity = getState().ring_capacity;
+        auto num_channels = getState().num_channels;
+        auto* rings = static_cast<char*> (m_memory) + alignUp (sizeof (WorkerSharedState));
+
+        m_to_worker = SharedAudioRing (rings, capacity, num_channels, initialise);
+        m_from_worker = SharedAudioRing (rings + alignUp (SharedAudioRing::getRequiredBytes (capacity, num_channels)), capacity, num_channels, initialise);
+    }
+
+    void* m_memory = nullptr;
+    size_t m_size = 0;
+    std::string m_name;
+    bool m_owner = false;
+    SharedAudioRing m_to_worker, m_from_worker;
+};
+} // namespace neural_worker
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <ATen/core/TensorBody.h>
+#include <algorithm>
+#include <filesystem>
 #ifndef ANIRA_LIBTORCHPROCESSOR_H
 #define ANIRA_LIBTORCHPROCESSOR_H
 
@@ -19,6 +21,9 @@
 #endif
 
 #include <anira/anira.h>
+#include "./InferenceMonitor.h"
+#include "./InferenceThreading.h"
+#include "./InstancePool.h"
 
 // LibTorch headers trigger many warnings; disabling for cleaner build logs
 #ifdef _MSC_VER
@@ -38,31 +43,82 @@
 #pragma GCC diagnostic pop
 #endif
 
+class BatchedInferenceServer;
+
 class RAVEProcessor : public anira::BackendBase
 {
 public:
-    RAVEProcessor (anira::InferenceConfig& inference_config);
+    // How the TorchScript module is prepared at load time
+    struct LoadOptions
+    {
+        // Inline the weights as constants (torch::jit::freeze) and run the inference
+        // graph passes (torch::jit::optimize_for_inference), keeping the RAVE methods
+        bool optimize = false;
+
+        // Load the dynamically quantized int8 export, <name>_int8.ts, when there is one
+        bool quantized = false;
+
+        // Run forward through the process-wide BatchedInferenceServer, batched with every
+        // other processor using the same model, instead of on this processor's instances
+        bool batched = false;
+    };
+
+    // A morph model, if given, runs next to the main one on every inference, its output
+    // or latents blended in by LatentControls::morph
+    RAVEProcessor (anira::InferenceConfig& inference_config, LoadOptions load_options = {}, const std::string& morph_model_file = {});
     ~RAVEProcessor();
 
     void prepare() override;
     void process (anira::AudioBufferF& input, anira::AudioBufferF& output, std::shared_ptr<anira::SessionElement> session) override;
 
-private:
-    struct Instance
+    // Real-time controls for the split encode -> latent transform -> decode mode.
+    // When splitEncodeDecode is off, the model's forward method is used as is.
+    struct LatentControls
     {
-        Instance (anira::InferenceConfig& inference_config);
-        void prepare();
-        void process (anira::AudioBufferF& input, anira::AudioBufferF& output, std::shared_ptr<anira::SessionElement> session);
+        std::atomic<bool> splitEncodeDecode { false };
+        std::atomic<float> bias { 0.0f };
+        std::atomic<float> scale { 1.0f };
+        std::atomic<bool> freeze { false };
+
+        // How far to go from the main model towards the morph model, from 0 to 1. Either
+        // the two outputs are crossfaded, or the latents of both encoders are interpolated
+        // and the result decoded by both decoders (only when their latents line up).
+        std::atomic<float> morph { 0.0f };
+        std::atomic<bool> morphLatents { false };
+    };
 
-        torch::jit::script::Module m_module;
+    LatentControls& getLatentControls() { return m_latent_controls; }
 
-        std::vector<anira::MemoryBlock<float>> m_input_data;
+    // The pool holds one slot per instance, i.e. InferenceConfig::m_num_parallel_processors
+    InstancePool::Stats getPoolStats() const { return m_pool.getStats(); }
 
-        std::vector<c10::IValue> m_inputs;
-        c10::IValue m_outputs;
+    size_t getNumInstancesInUse() const { return m_pool.getNumInUse(); }
 
-        anira::InferenceConfig& m_inference_config;
-        std::atomic<bool> m_processing { false };
+    // Timing of every inference, including any wait for a free instance
+    InferenceMonitor& getMonitor() { return m_monitor; }
+
+    // The scripted module and the RAVE metadata read from it. There is one per processor,
+    // and every further instance runs a clone of it that shares the weights but has its
+    // own streaming buffers (see getInstanceModel).
+    struct Model
+    {
+        Model (const std::string& model_file, LoadOptions load_options);
+
+        // Shares the weights of an already loaded model. The module hierarchy is cloned
+        // around the same parameter tensors, and every other tensor (the streaming caches
+        // of the convolutions) is copied, so processors never share audio state.
+        explicit Model (std::shared_ptr<const Model> source);
+
+        // Process-wide, refcounted cache: the first processor to ask for a file (by path,
+        // modification time and load options) loads and parses it, and every later one
+        // gets a Model sharing those weights. The weights are freed with the last Model.
+        static std::shared_ptr<Model> acquire (const std::string& model_file, LoadOptions load_options);
+
+        torch::jit::script::Module m_module;
+        std::string rave_model_file;
+        bool loaded = false;
+        bool optimized = false;
+        bool quantized = false;
 
         bool stereo = false;
         bool has_prior = false;
@@ -72,13 +128,75 @@ private:
         at::Tensor encode_params;
         at::Tensor decode_params;
         at::Tensor prior_params;
-        std::string rave_model_file;
-        std::vector<torch::jit::IValue> inputs_rave;
-        at::Tensor latent_buffer;
 
-        int getFullLatentDimensions() { return latent_size; }
+        int getFullLatentDimensions() const { return latent_size; }
+
+        int getModelRatio() const { return encode_params.index ({ 3 }).item<int>(); }
+
+        int getInputBatches() const { return encode_params.index ({ 1 }).item<int>(); }
+
+        int getOutputBatches() const { return decode_params.index ({ 3 }).item<int>(); }
+
+        bool hasMethod (const std::string& method_name) const { return m_module.find_method (method_name).has_value(); }
+
+        static std::string getQuantizedPath (const std::string& model_file);
+
+    private:
+        void optimize();
+
+        std::shared_ptr<const Model> m_source; // owner of the shared weights, if any
+    };
+
+    const Model& getModel() const { return *m_model; }
+
+    // For running the model's other methods (e.g. the prior) outside of anira
+    std::shared_ptr<Model> getSharedModel() const { return m_model; }
+
+    // The model blended in by LatentControls::morph, or nullptr when there is none
+    const Model* getMorphModel() const { return m_morph_model.get(); }
+
+    bool canMorphLatents() const { return m_can_morph_latents; }
+
+private:
+    struct Instance
+    {
+        Instance (anira::InferenceConfig& inference_config, const LatentControls& latent_controls, std::shared_ptr<Model> model);
+        void prepare();
+        void bindInputs();
+        void warmUp();
+        void process (anira::AudioBufferF& input, anira::AudioBufferF& output, std::shared_ptr<anira::SessionElement> session);
+        void readInputs (anira::AudioBufferF& input, const std::shared_ptr<anira::SessionElement>& session);
+        void processEncodeDecode (anira::AudioBufferF& output);
+        at::Tensor encodeDecode();
+        at::Tensor inferAudio();
+        at::Tensor getAudioInput() { return m_inputs[m_inference_config.m_index_audio_data[anira::Input]].toTensor(); }
+        at::Tensor getOutputTensor (size_t index);
+        std::vector<int64_t> getInputShape (size_t index) const;
+
+        std::shared_ptr<Model> m_model;
+        torch::jit::script::Module& m_module;
+
+        BatchedInferenceServer* m_server = nullptr;
+        size_t m_server_lane = 0;
+
+        std::vector<anira::MemoryBlock<float>> m_input_data;
+
+        std::vector<c10::IValue> m_inputs;
+        c10::IValue m_outputs;
+
+        anira::InferenceConfig& m_inference_config;
+        const LatentControls& m_latent_controls;
+
+        std::vector<torch::jit::IValue> inputs_rave;
 
-        int getModelRatio() { return encode_params.index ({ 3 }).item<int>(); }
+        // Fixed-size circular history of the encoded latents, plus the frame that is
+        // actually decoded. Both are allocated once, after probing the latent shape.
+        // While frozen, the history is played back in a loop instead of being written.
+        at::Tensor latent_buffer;
+        at::Tensor latent_frame;
+        int64_t latent_write_position = 0;
+        int64_t latent_frames_written = 0; // up to MAX_LATENT_BUFFER_SIZE
+        int64_t latent_loop_position = 0;
 
         torch::Tensor sample_prior (const int n_steps, const float temperature)
         {
@@ -119,47 +237,231 @@ private:
             return y;
         }
 
-        int getInputBatches() { return encode_params.index ({ 1 }).item<int>(); }
+        void allocateLatentBuffer (const at::Tensor& latent)
+        {
+            latent_buffer = torch::zeros ({ latent.size (0), latent.size (1), MAX_LATENT_BUFFER_SIZE });
+            latent_frame = torch::zeros_like (latent);
+            latent_write_position = 0;
+            latent_frames_written = 0;
+            latent_loop_position = 0;
+        }
+
+        void resetLatentBuffer()
+        {
+            latent_buffer.zero_();
+            latent_frame.zero_();
+            latent_write_position = 0;
+            latent_frames_written = 0;
+            latent_loop_position = 0;
+        }
+
+        void writeLatentBuffer (const at::Tensor& latent)
+        {
+            auto remaining = std::min<int64_t> (latent.size (2), MAX_LATENT_BUFFER_SIZE);
+            auto source = latent.size (2) - remaining;
 
-        int getOutputBatches() { return decode_params.index ({ 3 }).item<int>(); }
+            while (remaining > 0)
+            {
+                auto chunk = std::min<int64_t> (remaining, MAX_LATENT_BUFFER_SIZE - latent_write_position);
+                latent_buffer.narrow (2, latent_write_position, chunk).copy_ (latent.narrow (2, source, chunk));
+                latent_write_position = (latent_write_position + chunk) % MAX_LATENT_BUFFER_SIZE;
+                source += chunk;
+                remaining -= chunk;
+            }
 
-        void resetLatentBuffer() { latent_buffer = torch::zeros ({ 0 }); }
+            latent_frames_written = std::min<int64_t> (latent_frames_written + latent.size (2), MAX_LATENT_BUFFER_SIZE);
+            latent_loop_position = 0;
+        }
 
-        void writeLatentBuffer (at::Tensor latent)
+        // Fills frame with the next frames of a loop over everything written since the
+        // last reset, oldest first, picking up where the previous read stopped
+        void readLatentBuffer (at::Tensor& frame)
         {
-            if (latent_buffer.size (0) == 0)
+            auto length = std::max<int64_t> (1, latent_frames_written);
+            auto start = (latent_write_position - length + MAX_LATENT_BUFFER_SIZE) % MAX_LATENT_BUFFER_SIZE;
+
+            for (int64_t written = 0; written < frame.size (2);)
             {
-                latent_buffer = latent;
+                auto position = (start + latent_loop_position) % MAX_LATENT_BUFFER_SIZE;
+                auto chunk = std::min ({ frame.size (2) - written, MAX_LATENT_BUFFER_SIZE - position, length - latent_loop_position });
+                frame.narrow (2, written, chunk).copy_ (latent_buffer.narrow (2, position, chunk));
+                latent_loop_position = (latent_loop_position + chunk) % length;
+                written += chunk;
             }
-            else
+        }
+
+        // The latents to decode next: the encoder's while live, or the loop over the
+        // history while frozen, with the latent scale and bias applied either way
+        const at::Tensor& nextLatentFrame (const at::Tensor& latent)
+        {
+            if (m_latent_controls.freeze.load())
             {
-                latent_buffer = torch::cat ({ latent_buffer, latent }, 2);
+                readLatentBuffer (latent_frame);
             }
-            if (latent_buffer.size (2) > MAX_LATENT_BUFFER_SIZE)
+            else
             {
-                latent_buffer = latent_buffer.index (
-                    { "...", at::indexing::Slice (-MAX_LATENT_BUFFER_SIZE, at::indexing::None, at::indexing::None) });
+                writeLatentBuffer (latent);
+                latent_frame.copy_ (latent);
             }
+
+            return latent_frame.mul_ (m_latent_controls.scale.load()).add_ (m_latent_controls.bias.load());
         }
     };
 
+    std::shared_ptr<Model> getInstanceModel (const std::shared_ptr<Model>& model, size_t index) const;
+    void processMorph (Instance& main, Instance& morph, float amount, anira::AudioBufferF& input, anira::AudioBufferF& output, const std::shared_ptr<anira::SessionElement>& session);
+
+    std::shared_ptr<Model> m_model;
+    std::shared_ptr<BatchedInferenceServer> m_server;
+    std::shared_ptr<Model> m_server_model; // run by the server's thread, never by an instance
+    size_t m_server_lane = 0;
     std::vector<std::shared_ptr<Instance>> m_instances;
+
+    // One morph instance per instance, used with the same pool slot
+    std::shared_ptr<Model> m_morph_model;
+    std::vector<std::shared_ptr<Instance>> m_morph_instances;
+    bool m_can_morph_latents = false;
+
+    InstancePool m_pool;
+    InferenceMonitor m_monitor;
+    LatentControls m_latent_controls;
 };
 
 #endif
 #endif // ANIRA_LIBTORCHPROCESSOR_H
 
-static std::vector<anira::ModelData> model_data_config = {
-    { std::string (RAVE_MODELS_PATH_PYTORCH) + std::string ("/sol_ordinario_fast.ts"), anira::InferenceBackend::LIBTORCH },
+static const std::string rave_default_model_path = std::string (RAVE_MODELS_PATH_PYTORCH) + std::string ("/sol_ordinario_fast.ts");
+static const std::string rave_default_model_path_onnx = std::string (RAVE_MODELS_PATH_ONNX) + std::string ("/sol_ordinario_fast.onnx");
+static const std::string rave_default_model_path_tflite = std::string (RAVE_MODELS_PATH_TFLITE) + std::string ("/sol_ordinario_fast.tflite");
 
+// The LibTorch export always runs through the custom RAVEProcessor backend (which adds
+// the encode / decode mode). ONNX and TFLite exports are stateless forward-only graphs
+// run by anira's own backends, and are only listed when anira was built with them.
+static std::vector<anira::ModelData> model_data_config = {
+    { rave_default_model_path, anira::InferenceBackend::LIBTORCH },
+#ifdef USE_ONNXRUNTIME
+    { rave_default_model_path_onnx, anira::InferenceBackend::ONNX },
+#endif
+#ifdef USE_TFLITE
+    { rave_default_model_path_tflite, anira::InferenceBackend::TFLITE },
+#endif
 };
 
-static std::vector<anira::TensorShape> tensor_shape_config = {
-    { { { 1, 1, 1024 } }, { { 1, 1, 1024 } }, anira::InferenceBackend::LIBTORCH },
+// Both channels go through a single forward call: mono models see them as a batch of
+// two ({ 2, 1, N }), stereo models as one two-channel example ({ 1, 2, N }), which has
+// the same memory layout.
+static constexpr size_t rave_num_audio_channels = 2;
 
+// Model block sizes the processor can choose from. Smaller blocks mean less latency
+// but more inferences per second; NeuralProcessor picks the smallest one that this
+// machine can run in time for the host's block size.
+static const std::vector<size_t> rave_block_size_candidates = { 256, 512, 1024, 2048 };
+static constexpr size_t rave_default_block_size = 1024;
+
+// TFLite exports are converted to channels-last, so their audio axis comes before the channel axis
+static std::vector<anira::TensorShape> makeRAVETensorShapes (size_t block_size)
+{
+    return {
+        { { { rave_num_audio_channels, 1, block_size } }, { { rave_num_audio_channels, 1, block_size } }, anira::InferenceBackend::LIBTORCH },
+#ifdef USE_ONNXRUNTIME
+        { { { rave_num_audio_channels, 1, block_size } }, { { rave_num_audio_channels, 1, block_size } }, anira::InferenceBackend::ONNX },
+#endif
+#ifdef USE_TFLITE
+        { { { rave_num_audio_channels, block_size, 1 } }, { { rave_num_audio_channels, block_size, 1 } }, anira::InferenceBackend::TFLITE },
+#endif
+    };
+}
+
+static std::vector<anira::TensorShape> tensor_shape_config = makeRAVETensorShapes (rave_default_block_size);
+
+// anira waits this long (in ms) for an inference before counting it as late, and delays
+// the output by as much. This default is only a guess; NeuralCalibration replaces it with
+// what the model actually takes on the machine running it.
+static constexpr float rave_default_max_inference_time = 42.66f;
+
+// How a model is run: its block size, the time anira waits for each inference and how
+// many inferences may run at once. Converts from a plain block size.
+struct RAVERunSettings
+{
+    RAVERunSettings (size_t block = rave_default_block_size, float max_time = rave_default_max_inference_time, unsigned int parallel = 0)
+        : block_size (block)
+        , max_inference_time (max_time)
+        , num_parallel_processors (parallel)
+    {
+    }
+
+    size_t block_size;
+    float max_inference_time;             // ms
+    unsigned int num_parallel_processors; // 0 for InferenceThreading's setting, or anira's default
 };
 
-static anira::InferenceConfig RAVEConfig (
-    model_data_config,
-    tensor_shape_config,
-    42.66f);
+static anira::InferenceConfig makeRAVEConfig (std::vector<anira::ModelData> model_data, unsigned int warm_up = 0, RAVERunSettings settings = {})
+{
+    auto tensor_shapes = settings.block_size == rave_default_block_size ? tensor_shape_config : makeRAVETensorShapes (settings.block_size);
+
+    anira::InferenceConfig config (
+        model_data,
+        tensor_shapes,
+        settings.max_inference_time,
+        0,
+        warm_up,
+        { 0, 0 },
+        { rave_num_audio_channels, rave_num_audio_channels });
+
+    if (settings.num_parallel_processors > 0)
+        config.m_num_parallel_processors = settings.num_parallel_processors;
+    else if (auto num_parallel_processors = InferenceThreading::get().num_parallel_processors; num_parallel_processors > 0)
+        config.m_num_parallel_processors = num_parallel_processors;
+
+    return config;
+}
+
+// Same settings as the default config, for another TorchScript export. TorchScript
+// takes any block size, but ONNX and TFLite graphs have a fixed shape, so their exports
+// are looked up as <name>_<block size>.onnx (or plain <name>.onnx for the default size),
+// next to the .ts file or in their backend's model folder.
+static anira::InferenceConfig makeRAVEConfig (const std::string& model_path, unsigned int warm_up = 0, RAVERunSettings settings = {})
+{
+    std::vector<anira::ModelData> model_data { { model_path, anira::InferenceBackend::LIBTORCH } };
+    auto block_size = settings.block_size;
+
+    auto find_export = [&model_path, block_size] (const char* extension, const std::string& backend_folder)
+    {
+        auto stem = std::filesystem::path (model_path).stem().string();
+        std::vector<std::string> names { stem + "_" + std::to_string (block_size) + extension };
+
+        if (block_size == rave_default_block_size)
+            names.push_back (stem + extension);
+
+        for (auto& name : names)
+        {
+            for (auto folder : { std::filesystem::path (model_path).parent_path(), std::filesystem::path (backend_folder) })
+            {
+                if (std::filesystem::exists (folder / name))
+                    return (folder / name).string();
+            }
+        }
+
+        return std::string();
+    };
+
+#ifdef USE_ONNXRUNTIME
+    if (auto path = find_export (".onnx", RAVE_MODELS_PATH_ONNX); ! path.empty())
+        model_data.push_back ({ path, anira::InferenceBackend::ONNX });
+#endif
+#ifdef USE_TFLITE
+    if (auto path = find_export (".tflite", RAVE_MODELS_PATH_TFLITE); ! path.empty())
+        model_data.push_back ({ path, anira::InferenceBackend::TFLITE });
+#endif
+
+    (void) find_export;
+    return makeRAVEConfig (model_data, warm_up, settings);
+}
+
+static bool hasModelFor (const anira::InferenceConfig& config, anira::InferenceBackend backend)
+{
+    return std::any_of (config.m_model_data.begin(), config.m_model_data.end(), [backend] (const anira::ModelData& data)
+                        { return data.m_backend == backend; });
+}
+
+static anira::InferenceConfig RAVEConfig = makeRAVEConfig (model_data_config);
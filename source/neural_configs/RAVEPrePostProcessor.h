@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <anira/anira.h>
+
+// anira's PrePostProcessor with contiguous storage for the model's non-audio inputs
+// (latent controls, conditioning vectors...), so that they are written and read in bulk
+// instead of one element at a time through set_input and get_input.
+//
+// Each input is a seqlock-protected block of floats: a write is two counter bumps
+// around one memcpy and never blocks, and a read is a memcpy that is retried in the
+// rare case that it overlapped a write. RAVEProcessor copies these blocks straight into
+// its bound input tensors. One writer per input.
+class RAVEPrePostProcessor : public anira::PrePostProcessor
+{
+public:
+    explicit RAVEPrePostProcessor (const anira::InferenceConfig& config)
+        : m_inputs (config.m_input_sizes.size())
+    {
+        for (size_t i = 0; i < m_inputs.size(); ++i)
+        {
+            if (i != config.m_index_audio_data[anira::Input])
+            {
+                m_inputs[i].values.assign (config.m_input_sizes[i], 0.0f);
+            }
+        }
+    }
+
+    size_t getNumInputValues (size_t input) const { return input < m_inputs.size() ? m_inputs[input].values.size() : 0; }
+
+    void writeInput (size_t input, const float* values, size_t num_values)
+    {
+        auto& block = m_inputs[input];
+        auto count = std::min (num_values, block.values.size());
+
+        block.sequence.fetch_add (1, std::memory_order_acq_rel); // odd while writing
+        std::atomic_thread_fence (std::memory_order_release);
+        std::memcpy (block.values.data(), values, count * sizeof (float));
+        block.sequence.fetch_add (1, std::memory_order_release);
+    }
+
+    // Copies up to num_values of the input to destination and returns how many it copied
+    size_t readInput (size_t input, float* destination, size_t num_values) const
+    {
+        auto& block = m_inputs[input];
+        auto count = std::min (num_values, block.values.size());
+
+        for (;;)
+        {
+            auto before = block.sequence.load (std::memory_order_acquire);
+
+            if ((before & 1) == 0)
+            {
+                std::memcpy (destination, block.values.data(), count * sizeof (float));
+                std::atomic_thread_fence (std::memory_order_acquire);
+
+                if (block.sequence.load (std::memory_order_relaxed) == before)
+                {
+                    return count;
+                }
+            }
+
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    struct Input
+    {
+        std::atomic<unsigned int> sequence { 0 };
+        std::vector<float> values; // empty for the audio input
+    };
+
+    std::vector<Input> m_inputs;
+};
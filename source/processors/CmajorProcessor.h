@@ -33,6 +33,7 @@
 #endif
 
 #include <utility>
+#include "../utils/SampleLibrary.h"
 #include "../3rd_party/cmajor/include/cmajor/helpers/cmaj_PatchWebView.h"
 
 #if CMAJ_USE_QUICKJS_WORKER
@@ -197,7 +198,9 @@ public:
     {
         if (! patch->isPlayable() || processorRef.isSuspended())
         {
-            audio.clear();
+            if (! isInsertEffect)
+                audio.clear();
+
             midi.clear();
             return;
         }
@@ -226,8 +229,8 @@ public:
     cmaj::Patch::PlaybackParams getPlaybackParams (double rate, uint32_t requestedBlockSize)
     {
         auto layout = processorRef.getBusesLayout();
-        auto ins = static_cast<choc::buffer::ChannelCount> (layout.getMainInputChannels());
         auto outs = static_cast<choc::buffer::ChannelCount> (layout.getMainOutputChannels());
+        auto ins = isInsertEffect ? outs : static_cast<choc::buffer::ChannelCount> (layout.getMainInputChannels());
 
         std::cout << "Num ins about to be set in Cmajor" << juce::String (ins) << std::endl;
         std::cout << "Num outs about to be set in Cmajor" << juce::String (outs) << std::endl;
@@ -245,6 +248,88 @@ public:
         applyRateAndBlockSize (sampleRate, static_cast<uint32_t> (blockSize));
     }
 
+    //==============================================================================
+    /// Writes a compact binary snapshot of the parameter values and stored state
+    /// values. Unlike getUpdatedState(), this doesn't build a ValueTree, and a
+    /// snapshot of the patch that's already running can be restored without
+    /// recompiling it.
+    void writeSnapshot (juce::OutputStream& out)
+    {
+        out.writeInt (snapshotMagic);
+        out.writeInt (snapshotVersion);
+        out.writeInt64 (getPatchHash());
+        out.writeString (getManifestFile (*patch).getFullPathName());
+        out.writeInt (lastEditorWidth);
+        out.writeInt (lastEditorHeight);
+
+        auto params = patch->getParameterList();
+        out.writeCompressedInt ((int) params.size());
+
+        for (auto& p : params)
+        {
+            out.writeString (juce::String (p->properties.endpointID));
+            out.writeFloat (p->currentValue);
+        }
+
+        const auto& values = patch->getStoredStateValues();
+        out.writeCompressedInt ((int) values.size());
+
+        for (auto& v : values)
+        {
+            auto serialised = v.second.serialise();
+            out.writeString (juce::String (v.first.data(), v.first.length()));
+            out.writeCompressedInt ((int) serialised.data.size());
+            out.write (serialised.data.data(), serialised.data.size());
+        }
+    }
+
+    /// Reads a snapshot written by writeSnapshot(). If it was taken from the patch
+    /// that's currently loaded, its values are pushed straight into the running
+    /// engine; otherwise it falls back to a full reload of the stored patch.
+    bool readSnapshot (juce::InputStream& in)
+    {
+        if (in.readInt() != snapshotMagic || in.readInt() != snapshotVersion)
+            return false;
+
+        auto m = std::make_unique<SnapshotMessage>();
+        m->patchHash = in.readInt64();
+        m->location = in.readString();
+        m->viewWidth = in.readInt();
+        m->viewHeight = in.readInt();
+
+        for (auto i = in.readCompressedInt(); --i >= 0 && ! in.isExhausted();)
+        {
+            auto endpointID = in.readString().toStdString();
+            m->parameterValues.emplace_back (std::move (endpointID), in.readFloat());
+        }
+
+        for (auto i = in.readCompressedInt(); --i >= 0 && ! in.isExhausted();)
+        {
+            auto key = in.readString().toStdString();
+            auto size = in.readCompressedInt();
+            juce::MemoryBlock data;
+
+            if (size <= 0 || size > in.getNumBytesRemaining())
+                return false;
+
+            if (in.readIntoMemoryBlock (data, size) > 0)
+            {
+                // Malformed values make choc throw; drop the value rather than the snapshot
+                try
+                {
+                    auto inputData = choc::value::InputData { (unsigned char*) data.begin(), (unsigned char*) data.end() };
+                    m->storedValues.emplace_back (std::move (key), choc::value::Value::deserialise (inputData));
+                }
+                catch (const std::exception&)
+                {
+                }
+            }
+        }
+
+        postMessage (m.release());
+        return true;
+    }
+
     double sampleRate = 48000;
     uint32_t blockSize = 2048;
     std::shared_ptr<cmaj::Patch> patch;
@@ -252,6 +337,10 @@ public:
     std::string statusMessage;
     bool isStatusMessageError = false;
 
+    /// When set, the patch processes the audio it's given in place (taking as many
+    /// inputs as the host has outputs) and lets it through untouched while unloaded.
+    bool isInsertEffect = false;
+
 protected:
     uint64_t lastLoadedStateHash = 0;
 
@@ -497,10 +586,86 @@ protected:
         juce::ValueTree newState;
     };
 
+    static constexpr int snapshotMagic = 0x534a4d43; // "CMJS"
+    static constexpr int snapshotVersion = 1;
+
+    struct SnapshotMessage : public juce::Message
+    {
+        juce::int64 patchHash = 0;
+        juce::String location;
+        int viewWidth = 0, viewHeight = 0;
+        std::vector<std::pair<std::string, float>> parameterValues;
+        std::vector<std::pair<std::string, choc::value::Value>> storedValues;
+    };
+
+    juce::int64 getPatchHash() const
+    {
+        return juce::String (createPatchID (*patch)).hashCode64();
+    }
+
+    void restoreSnapshot (const SnapshotMessage& snapshot)
+    {
+        if (! patch->isLoaded() || snapshot.patchHash != getPatchHash())
+            return setNewState (createStateFromSnapshot (snapshot));
+
+        if (isViewResizable())
+        {
+            lastEditorWidth = snapshot.viewWidth;
+            lastEditorHeight = snapshot.viewHeight;
+        }
+
+        for (auto& v : snapshot.storedValues)
+            patch->setStoredStateValue (v.first, v.second);
+
+        auto params = patch->getParameterList();
+
+        for (auto& v : snapshot.parameterValues)
+            for (auto& p : params)
+                if (p->properties.endpointID == v.first)
+                    p->setValue (v.second, false, -1, 0);
+    }
+
+    juce::ValueTree createStateFromSnapshot (const SnapshotMessage& snapshot) const
+    {
+        auto state = createEmptyState (snapshot.location.toStdString());
+
+        if (snapshot.viewWidth != 0 && snapshot.viewHeight != 0)
+        {
+            state.setProperty (ids.viewWidth, snapshot.viewWidth, nullptr);
+            state.setProperty (ids.viewHeight, snapshot.viewHeight, nullptr);
+        }
+
+        juce::ValueTree stateValues (ids.STATE);
+
+        for (auto& v : snapshot.storedValues)
+        {
+            auto serialised = v.second.serialise();
+            stateValues.appendChild (juce::ValueTree (ids.VALUE,
+                                                      { { ids.key, juce::String (v.first) },
+                                                        { ids.value, juce::var (serialised.data.data(), serialised.data.size()) } }),
+                                     nullptr);
+        }
+
+        state.appendChild (stateValues, nullptr);
+
+        juce::ValueTree paramList (ids.PARAMS);
+
+        for (auto& v : snapshot.parameterValues)
+            paramList.appendChild (juce::ValueTree (ids.PARAM,
+                                                    { { ids.ID, juce::String (v.first) },
+                                                      { ids.V, v.second } }),
+                                   nullptr);
+
+        state.appendChild (paramList, nullptr);
+        return state;
+    }
+
     void handleMessage (const juce::Message& message) override
     {
         if (auto m = dynamic_cast<const NewStateMessage*> (&message))
             setNewState (const_cast<NewStateMessage*> (m)->newState);
+        else if (auto s = dynamic_cast<const SnapshotMessage*> (&message))
+            restoreSnapshot (*s);
     }
 
     void handleOutputEvent (uint64_t, std::string_view endpointID, const choc::value::ValueView& value)
@@ -996,6 +1161,17 @@ public:
     static constexpr bool isPrecompiled = false;
     static constexpr bool isFixedPatch = false;
 
+    static std::shared_ptr<cmaj::Patch> createPatch()
+    {
+        auto patch = std::make_shared<cmaj::Patch>();
+        patch->setAutoRebuildOnFileChange (true);
+        patch->createEngine = +[]
+        {
+            return cmaj::Engine::create();
+        };
+        return patch;
+    }
+
     void loadPatch (const std::filesystem::path& fileToLoad)
     {
         setNewStateAsync (createEmptyState (fileToLoad));
@@ -1025,6 +1201,7 @@ public:
             return false;
 
         loadParams.manifest.initialiseWithFile (location);
+        mapSampleFiles (loadParams.manifest);
 
         if (! patch->isLoaded() || loadParams.manifest.manifestFile == patch->getPatchFile())
             readParametersFromState (loadParams, newState);
@@ -1037,6 +1214,28 @@ public:
         return patch->isPlayable();
     }
 
+    /// Routes the audio files a patch binds to its externals through the SampleLibrary,
+    /// so they're read from a memory mapping instead of a fresh file stream per load.
+    /// The engine still keeps its own copy of the decoded samples. Anything else goes
+    /// through the manifest's own reader.
+    void mapSampleFiles (cmaj::PatchManifest& manifest)
+    {
+        auto patchFolder = juce::File (manifest.getFullPathForFile (manifest.manifestFile)).getParentDirectory();
+
+        manifest.createFileReader = [patchFolder, library = sampleLibrary, readFile = manifest.createFileReader] (const std::string& path) -> std::shared_ptr<std::istream>
+        {
+            auto file = patchFolder.getChildFile (path);
+
+            if (SampleLibrary::isSampleFile (file))
+                if (auto stream = (*library)->createInputStream (file))
+                    return stream;
+
+            return readFile (path);
+        };
+    }
+
+    std::shared_ptr<juce::SharedResourcePointer<SampleLibrary>> sampleLibrary = std::make_shared<juce::SharedResourcePointer<SampleLibrary>>();
+
     struct ExtraEditorComponent : public juce::Component
         , public juce::FileDragAndDropTarget
     {
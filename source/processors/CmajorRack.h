@@ -0,0 +1,143 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include "./CmajorProcessor.h"
+
+//==============================================================================
+/// A fixed number of Cmajor effect slots run in series after the generator.
+///
+/// Every slot owns its own JIT engine and processes the plugin's buffer in place,
+/// so audio flows from one patch to the next without intermediate copies. Slots
+/// are all created up front and stay in the chain whether or not a patch is
+/// loaded (an empty slot passes audio through), so patches can be swapped from
+/// the message thread without touching the audio thread's view of the chain.
+/// Every slot starts empty; patches only come from the user or a saved state.
+struct CmajorRack
+{
+public:
+    static constexpr int numSlots = 4;
+
+    explicit CmajorRack (juce::AudioProcessor& p)
+    {
+        for (auto& slot : slots)
+        {
+            slot = std::make_unique<CmajorJITProcessor> (CmajorJITProcessor::createPatch(), p);
+            slot->isInsertEffect = true;
+        }
+    }
+
+    //==============================================================================
+    void prepare (juce::dsp::ProcessSpec& spec)
+    {
+        for (auto& slot : slots)
+            slot->prepare (spec);
+
+        midiScratch.ensureSize (256);
+    }
+
+    void reset()
+    {
+        for (auto& slot : slots)
+            slot->reset();
+    }
+
+    void process (juce::AudioBuffer<float>& audio)
+    {
+        for (auto& slot : slots)
+        {
+            midiScratch.clear();
+            slot->process (audio, midiScratch);
+        }
+    }
+
+    //==============================================================================
+    void loadPatch (int slotIndex, const std::filesystem::path& fileToLoad)
+    {
+        getSlot (slotIndex).loadPatch (fileToLoad);
+    }
+
+    void unloadPatch (int slotIndex)
+    {
+        getSlot (slotIndex).unload();
+    }
+
+    CmajorJITProcessor& getSlot (int slotIndex)
+    {
+        jassert (juce::isPositiveAndBelow (slotIndex, numSlots));
+        return *slots[(size_t) slotIndex];
+    }
+
+private:
+    std::array<std::unique_ptr<CmajorJITProcessor>, numSlots> slots;
+    juce::MidiBuffer midiScratch;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CmajorRack)
+};
+
+//==============================================================================
+/// One button per rack slot, showing the patch it holds; clicking one loads another
+/// patch into the slot or empties it
+struct CmajorRackControls final : public juce::Component
+    , private juce::Timer
+{
+    explicit CmajorRackControls (CmajorRack& r)
+        : rack (r)
+    {
+        for (int i = 0; i < CmajorRack::numSlots; ++i)
+        {
+            auto& button = buttons[(size_t) i];
+            addAndMakeVisible (button);
+
+            button.onClick = [this, i, &button]
+            {
+                juce::PopupMenu menu;
+                menu.addItem ("Load patch...", [this, i] { choosePatch (i); });
+                menu.addItem ("Empty slot", rack.getSlot (i).patch->isLoaded(), false, [this, i] { rack.unloadPatch (i); });
+                menu.showMenuAsync (juce::PopupMenu::Options().withTargetComponent (button));
+            };
+        }
+
+        updateButtons();
+        startTimerHz (4);
+    }
+
+    void resized() override
+    {
+        auto area = getLocalBounds();
+        auto width = area.getWidth() / CmajorRack::numSlots;
+
+        for (auto& button : buttons)
+            button.setBounds (area.removeFromLeft (width).reduced (2));
+    }
+
+private:
+    // Patches load asynchronously, so the names are polled
+    void timerCallback() override { updateButtons(); }
+
+    void updateButtons()
+    {
+        for (int i = 0; i < CmajorRack::numSlots; ++i)
+        {
+            auto& patch = *rack.getSlot (i).patch;
+            auto name = patch.isLoaded() ? CmajorJITProcessor::getManifestFile (patch).getFileNameWithoutExtension() : juce::String ("Empty");
+            buttons[(size_t) i].setButtonText (juce::String (i + 1) + ": " + name);
+        }
+    }
+
+    void choosePatch (int slotIndex)
+    {
+        fileChooser = std::make_unique<juce::FileChooser> ("Load a Cmajor patch", juce::File (CMAJOR_PATCHES_PATH), "*.cmajorpatch");
+        fileChooser->launchAsync (juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles,
+                                  [this, slotIndex] (const juce::FileChooser& chooser)
+                                  {
+                                      if (auto file = chooser.getResult(); file.existsAsFile())
+                                          rack.loadPatch (slotIndex, file.getFullPathName().toStdString());
+                                  });
+    }
+
+    CmajorRack& rack;
+    std::array<juce::TextButton, CmajorRack::numSlots> buttons;
+    std::unique_ptr<juce::FileChooser> fileChooser;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CmajorRackControls)
+};
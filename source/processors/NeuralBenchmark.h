@@ -0,0 +1,357 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <cmath>
+#include <limits>
+
+#include "../utils/Parameters.h"
+#include "./NeuralEngine.h"
+#include "./NeuralWorkerClient.h"
+
+//==============================================================================
+/// Offline comparison of the inference backends available for one model, of the
+/// ways it can be loaded and of threading settings.
+///
+/// Each backend runs the same noise input block by block with anira in
+/// non-realtime mode, so every call waits for its inference to finish and the
+/// measured time is the full round trip through the backend.
+struct NeuralBenchmark
+{
+    struct Result
+    {
+        juce::String backendType;
+        double meanMs = 0.0;
+        double maxMs = 0.0;
+        double realtimeFactor = 0.0; // block duration divided by the mean processing time
+        int missedDeadlines = 0;     // blocks that took longer to process than to play
+    };
+
+    /// Times every backend that has an export for the model, at one model block size.
+    static std::vector<Result> run (const juce::File& modelFile,
+                                    double sampleRate,
+                                    int blockSize,
+                                    size_t modelBlockSize = rave_default_block_size,
+                                    RAVEProcessor::LoadOptions loadOptions = {},
+                                    int numBlocks = 200,
+                                    int numWarmUpBlocks = 10)
+    {
+        std::vector<Result> results;
+
+        NeuralEngine engine (makeRAVEConfig (modelFile.getFullPathName().toStdString(), 0, modelBlockSize), modelFile, loadOptions);
+
+        if (! engine.raveProcessor.getModel().loaded)
+            return results;
+
+        engine.prepare ({ (size_t) blockSize, sampleRate });
+        engine.inferenceHandler.set_non_realtime (true);
+
+        for (auto& backendType : NeuralParameters::backendTypes)
+        {
+            auto backend = NeuralEngine::getBackendForChoice (backendType);
+
+            if (! engine.canUseBackend (backend) || (backend == anira::CUSTOM && backendType != "LIBTORCH"))
+                continue;
+
+            engine.setBackend (backend);
+            results.push_back (measure (engine, backendType, sampleRate, blockSize, numBlocks, numWarmUpBlocks));
+        }
+
+        return results;
+    }
+
+    struct VariantResult
+    {
+        juce::String name;
+        double meanMs = 0.0;
+        double snrDb = 0.0; // against the plain float model; infinite for identical output
+    };
+
+    /// Speed and quality of the ways a model can be loaded (as is, frozen and optimised,
+    /// int8, or both), all with the LibTorch backend. Every variant gets the same input
+    /// and random seed, so the error against the plain float model's output is down to
+    /// freezing and quantisation alone.
+    static std::vector<VariantResult> compareLoadOptions (const juce::File& modelFile,
+                                                          double sampleRate,
+                                                          size_t modelBlockSize = rave_default_block_size,
+                                                          int numBlocks = 100)
+    {
+        std::vector<VariantResult> results;
+        std::vector<std::pair<juce::String, RAVEProcessor::LoadOptions>> variants { { "float", { false, false } },
+                                                                                    { "float optimised", { true, false } } };
+
+        if (juce::File (RAVEProcessor::Model::getQuantizedPath (modelFile.getFullPathName().toStdString())).existsAsFile())
+        {
+            variants.push_back ({ "int8", { false, true } });
+            variants.push_back ({ "int8 optimised", { true, true } });
+        }
+
+        auto blockSize = (int) modelBlockSize;
+        juce::AudioBuffer<float> reference ((int) rave_num_audio_channels, blockSize * numBlocks);
+        juce::AudioBuffer<float> output (reference.getNumChannels(), reference.getNumSamples());
+        juce::AudioBuffer<float> buffer (reference.getNumChannels(), blockSize);
+
+        for (auto& [name, loadOptions] : variants)
+        {
+            NeuralEngine engine (makeRAVEConfig (modelFile.getFullPathName().toStdString(), 4, modelBlockSize), modelFile, loadOptions);
+
+            if (! engine.raveProcessor.getModel().loaded)
+                continue;
+
+            engine.prepare ({ modelBlockSize, sampleRate });
+            engine.inferenceHandler.set_non_realtime (true);
+            torch::manual_seed (0);
+
+            juce::Random random (1234);
+            auto& target = results.empty() ? reference : output;
+            double totalMs = 0.0;
+
+            for (int block = 0; block < numBlocks; ++block)
+            {
+                for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+                    for (int i = 0; i < blockSize; ++i)
+                        buffer.setSample (channel, i, 0.5f * std::sin (0.05f * (float) (block * blockSize + i)) + 0.1f * (random.nextFloat() * 2.0f - 1.0f));
+
+                auto start = juce::Time::getMillisecondCounterHiRes();
+                engine.process (juce::dsp::AudioBlock<float> (buffer));
+                totalMs += juce::Time::getMillisecondCounterHiRes() - start;
+
+                for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+                    target.copyFrom (channel, block * blockSize, buffer, channel, 0, blockSize);
+            }
+
+            VariantResult result { name, totalMs / juce::jmax (1, numBlocks), std::numeric_limits<double>::infinity() };
+
+            if (&target == &output)
+            {
+                double signal = 0.0, error = 0.0;
+
+                for (int channel = 0; channel < reference.getNumChannels(); ++channel)
+                {
+                    for (int i = 0; i < reference.getNumSamples(); ++i)
+                    {
+                        auto r = (double) reference.getSample (channel, i);
+                        auto d = r - (double) output.getSample (channel, i);
+                        signal += r * r;
+                        error += d * d;
+                    }
+                }
+
+                if (error > 0.0)
+                    result.snrDb = 10.0 * std::log10 (signal / error);
+            }
+
+            results.push_back (result);
+        }
+
+        return results;
+    }
+
+    static juce::String toString (const std::vector<VariantResult>& results)
+    {
+        juce::StringArray lines;
+
+        for (auto& result : results)
+            lines.add (result.name + ": " + juce::String (result.meanMs, 2) + " ms"
+                       + (std::isinf (result.snrDb) ? juce::String() : ", SNR " + juce::String (result.snrDb, 1) + " dB"));
+
+        return lines.joinIntoString (" | ");
+    }
+
+    struct ThreadingResult
+    {
+        juce::String description;
+        double meanMs = 0.0;
+        double maxMs = 0.0;
+        int missedDeadlines = 0;
+        double realtimeTracks = 0.0; // seconds of audio processed per second, over all tracks
+    };
+
+    /// A spread of thread counts against intra-op threads for numTracks tracks, then the
+    /// best-guess count pinned to the upper half of the cores and/or given a realtime
+    /// priority, where the platform supports either
+    static std::vector<InferenceThreadingOptions> getThreadingCandidates (int numTracks)
+    {
+        auto cores = (unsigned int) juce::jmax (1, juce::SystemStats::getNumCpus());
+        auto perTrack = juce::jmin (cores, (unsigned int) numTracks);
+        std::vector<InferenceThreadingOptions> candidates;
+
+        auto add = [&candidates] (unsigned int threads, unsigned int parallel, int intraOp, std::vector<int> affinity = {}, int priority = 0)
+        {
+            InferenceThreadingOptions options;
+            options.num_inference_threads = threads;
+            options.num_parallel_processors = parallel;
+            options.intra_op_threads = intraOp;
+            options.cpu_affinity = std::move (affinity);
+            options.realtime_priority = priority;
+            candidates.push_back (options);
+        };
+
+        add (0, 0, 1);                                                             // the defaults
+        add (perTrack, 1, 1);                                                      // one thread per track
+        add (cores, 2, 1);                                                         // every core, two inferences per track
+        add (juce::jmax (1u, cores / 4), 1, 4);                                    // fewer, wider inferences
+
+#if JUCE_LINUX
+        std::vector<int> upperHalf;
+
+        for (auto cpu = cores / 2; cpu < cores; ++cpu)
+            upperHalf.push_back ((int) cpu);
+
+        if (cores > 1)
+            add (juce::jmin (perTrack, (unsigned int) upperHalf.size()), 1, 1, upperHalf); // away from the host's audio threads
+
+        add (perTrack, 1, 1, {}, 10);                                              // realtime, if the user may
+        if (cores > 1)
+            add (juce::jmin (perTrack, (unsigned int) upperHalf.size()), 1, 1, upperHalf, 10);
+#endif
+        return candidates;
+    }
+
+    /// Runs numTracks engines at once, each driven by its own thread like a host track
+    /// would, under each set of threading options. Every candidate runs in a fresh
+    /// NeuralWorker process, so that anira's process-wide thread pool is created with
+    /// exactly its options and the plugin's own engine, settings and pool are never
+    /// touched. Not for the message thread: each run can take a while.
+    static std::vector<ThreadingResult> compareThreading (const juce::File& modelFile,
+                                                          double sampleRate,
+                                                          int blockSize,
+                                                          int numTracks,
+                                                          const std::vector<InferenceThreadingOptions>& candidates,
+                                                          size_t modelBlockSize = rave_default_block_size,
+                                                          int numBlocks = 100)
+    {
+        std::vector<ThreadingResult> results;
+        auto worker = NeuralWorkerClient::getWorkerExecutable();
+
+        for (auto& options : candidates)
+        {
+            ThreadingResult result { describe (options) };
+
+            juce::StringArray command { worker.getFullPathName(),
+                                        "--benchmark-threading",
+                                        "--model", modelFile.getFullPathName(),
+                                        "--block-size", juce::String (blockSize),
+                                        "--sample-rate", juce::String (sampleRate),
+                                        "--model-block-size", juce::String (modelBlockSize),
+                                        "--tracks", juce::String (numTracks),
+                                        "--blocks", juce::String (numBlocks),
+                                        "--threads", juce::String (options.num_inference_threads),
+                                        "--parallel", juce::String (options.num_parallel_processors),
+                                        "--intra-op", juce::String (options.intra_op_threads),
+                                        "--rt-priority", juce::String (options.realtime_priority) };
+
+            if (! options.cpu_affinity.empty())
+            {
+                juce::StringArray cpus;
+
+                for (auto cpu : options.cpu_affinity)
+                    cpus.add (juce::String (cpu));
+
+                command.addArray ({ "--affinity", cpus.joinIntoString (",") });
+            }
+
+            juce::ChildProcess process;
+
+            if (! worker.existsAsFile() || ! process.start (command, juce::ChildProcess::wantStdOut))
+            {
+                result.description << " (could not start " << worker.getFileName() << ")";
+                results.push_back (result);
+                continue;
+            }
+
+            // Reads until the worker exits, so its log output can never fill the pipe
+            auto output = process.readAllProcessOutput();
+            auto line = output.fromLastOccurrenceOf ("RESULT ", false, false).upToFirstOccurrenceOf ("\n", false, false);
+            auto values = juce::StringArray::fromTokens (line, " ", {});
+
+            if (output.contains ("RESULT ") && values.size() == 4)
+            {
+                result.meanMs = values[0].getDoubleValue();
+                result.maxMs = values[1].getDoubleValue();
+                result.missedDeadlines = values[2].getIntValue();
+                result.realtimeTracks = values[3].getDoubleValue();
+            }
+            else
+            {
+                result.description << " (failed, exit code " << (int) process.getExitCode() << ")";
+            }
+
+            results.push_back (result);
+        }
+
+        return results;
+    }
+
+    static juce::String describe (const InferenceThreadingOptions& options)
+    {
+        auto text = juce::String ("threads ") + (options.num_inference_threads > 0 ? juce::String (options.num_inference_threads) : "default")
+                  + ", parallel " + (options.num_parallel_processors > 0 ? juce::String (options.num_parallel_processors) : "default")
+                  + ", intra-op " + juce::String (options.intra_op_threads);
+
+        if (! options.cpu_affinity.empty())
+            text << ", " << (int) options.cpu_affinity.size() << " pinned cpus";
+
+        if (options.realtime_priority > 0)
+            text << ", rt priority " << options.realtime_priority;
+
+        return text;
+    }
+
+    static juce::String toString (const std::vector<ThreadingResult>& results)
+    {
+        juce::StringArray lines;
+
+        for (auto& result : results)
+            lines.add (result.description + ": " + juce::String (result.meanMs, 2) + " ms mean, " + juce::String (result.maxMs, 2)
+                       + " ms max, " + juce::String (result.missedDeadlines) + " missed, x" + juce::String (result.realtimeTracks, 1) + " realtime");
+
+        return lines.joinIntoString (" | ");
+    }
+
+    /// Runs one engine block by block on noise and times each process call
+    static Result measure (NeuralEngine& engine, const juce::String& backendType, double sampleRate, int blockSize, int numBlocks, int numWarmUpBlocks)
+    {
+        juce::AudioBuffer<float> buffer ((int) rave_num_audio_channels, blockSize);
+        juce::Random random;
+
+        Result result { backendType };
+        double totalMs = 0.0;
+        auto blockMs = 1000.0 * blockSize / sampleRate;
+
+        for (int block = -numWarmUpBlocks; block < numBlocks; ++block)
+        {
+            for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+                for (int i = 0; i < blockSize; ++i)
+                    buffer.setSample (channel, i, random.nextFloat() * 2.0f - 1.0f);
+
+            auto start = juce::Time::getMillisecondCounterHiRes();
+            engine.process (juce::dsp::AudioBlock<float> (buffer));
+            auto elapsed = juce::Time::getMillisecondCounterHiRes() - start;
+
+            if (block >= 0)
+            {
+                totalMs += elapsed;
+                result.maxMs = juce::jmax (result.maxMs, elapsed);
+
+                if (elapsed > blockMs)
+                    ++result.missedDeadlines;
+            }
+        }
+
+        result.meanMs = totalMs / juce::jmax (1, numBlocks);
+        result.realtimeFactor = result.meanMs > 0.0 ? blockMs / result.meanMs : 0.0;
+        return result;
+    }
+
+    static juce::String toString (const std::vector<Result>& results)
+    {
+        juce::StringArray lines;
+
+        for (auto& result : results)
+            lines.add (result.backendType + ": " + juce::String (result.meanMs, 2) + " ms mean, "
+                       + juce::String (result.maxMs, 2) + " ms max, x" + juce::String (result.realtimeFactor, 1) + " realtime, "
+                       + juce::String (result.missedDeadlines) + " missed");
+
+        return lines.isEmpty() ? juce::String ("No backend could run this model") : lines.joinIntoString (" | ");
+    }
+};
@@ -0,0 +1,336 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <climits>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <optional>
+#include <thread>
+
+#include "./NeuralBenchmark.h"
+#include "./NeuralEngine.h"
+
+//==============================================================================
+/// Measures how fast a model runs on this machine, and picks the way of running it
+/// with the lowest latency that still keeps up with the host.
+///
+/// Every model block size the model accepts is timed with 1, 2 and 4 inferences in
+/// flight at once, each on its own backend and thread like anira's parallel processors
+/// would run them. choose() turns those timings into the model block size, the number
+/// of parallel processors and the maximum inference time given to anira, which is how
+/// long anira waits for an inference and so how much latency it adds.
+///
+/// The backends are driven directly rather than through anira, so calibrating neither
+/// takes threads from nor adds load to the process-wide pool the playing engines use.
+struct NeuralCalibration
+{
+    struct Measurement
+    {
+        size_t modelBlockSize = 0;
+        unsigned int parallelProcessors = 1;
+        double meanMs = 0.0; // per inference, with parallelProcessors of them running at once
+        double maxMs = 0.0;
+    };
+
+    using Table = std::vector<Measurement>;
+
+    /// One model at one block size, run on the calling thread. It never goes through the
+    /// BatchedInferenceServer, which would put it in the playing engines' batches.
+    struct PrivateEngine
+    {
+        PrivateEngine (const juce::File& modelFile, size_t modelBlockSize, anira::InferenceBackend backendType, RAVEProcessor::LoadOptions loadOptions)
+            : config (makeRAVEConfig (modelFile.getFullPathName().toStdString(), 0, { modelBlockSize, rave_default_max_inference_time, 1 }))
+            , raveProcessor (config, unbatched (loadOptions))
+            , input (1, config.m_input_sizes[config.m_index_audio_data[anira::Input]])
+            , output (1, config.m_output_sizes[config.m_index_audio_data[anira::Output]])
+        {
+#ifdef USE_ONNXRUNTIME
+            if (backendType == anira::ONNX && hasModelFor (config, anira::ONNX))
+                otherBackend = std::make_unique<anira::OnnxRuntimeProcessor> (config);
+#endif
+#ifdef USE_TFLITE
+            if (backendType == anira::TFLITE && hasModelFor (config, anira::TFLITE))
+                otherBackend = std::make_unique<anira::TFLiteProcessor> (config);
+#endif
+            juce::ignoreUnused (backendType);
+
+            if (isLoaded())
+                getBackend().prepare();
+        }
+
+        bool isLoaded() const { return raveProcessor.getModel().loaded; }
+
+        size_t getModelRatio() const
+        {
+            auto& model = raveProcessor.getModel();
+            return model.encode_params.defined() ? (size_t) juce::jmax (1, model.getModelRatio()) : 1;
+        }
+
+        /// Runs one inference on noise and returns how long it took, in ms. RAVE configs
+        /// have no inputs or outputs besides the audio, so no anira session is needed.
+        double process (juce::Random& random)
+        {
+            auto* data = input.get_memory_block().data();
+
+            for (size_t i = 0; i < input.get_memory_block().size(); ++i)
+                data[i] = random.nextFloat() * 2.0f - 1.0f;
+
+            auto start = juce::Time::getMillisecondCounterHiRes();
+            getBackend().process (input, output, nullptr);
+            return juce::Time::getMillisecondCounterHiRes() - start;
+        }
+
+        anira::BackendBase& getBackend() { return otherBackend != nullptr ? *otherBackend : raveProcessor; }
+
+        static RAVEProcessor::LoadOptions unbatched (RAVEProcessor::LoadOptions options)
+        {
+            options.batched = false;
+            return options;
+        }
+
+        anira::InferenceConfig config;
+        RAVEProcessor raveProcessor;
+        std::unique_ptr<anira::BackendBase> otherBackend;
+        anira::AudioBufferF input, output;
+    };
+
+    /// Parallel processor counts worth trying. An explicit threading setting is kept as is.
+    static std::vector<unsigned int> getParallelCandidates()
+    {
+        if (auto parallel = InferenceThreading::get().num_parallel_processors; parallel > 0)
+            return { parallel };
+
+        auto cores = (unsigned int) juce::jmax (1, juce::SystemStats::getNumCpus());
+        std::vector<unsigned int> candidates;
+
+        for (unsigned int parallel = 1; parallel <= juce::jmin (4u, cores); parallel *= 2)
+            candidates.push_back (parallel);
+
+        return candidates;
+    }
+
+    /// Times every candidate model block size against every parallel processor count,
+    /// one inference at a time per thread
+    static Table measure (const juce::File& modelFile,
+                          anira::InferenceBackend backend,
+                          RAVEProcessor::LoadOptions loadOptions = {},
+                          int numBlocks = 40,
+                          int numWarmUpBlocks = 5)
+    {
+        Table table;
+        auto parallelCandidates = getParallelCandidates();
+        auto maxParallel = (size_t) parallelCandidates.back();
+
+        for (auto modelBlockSize : rave_block_size_candidates)
+        {
+            std::vector<std::unique_ptr<PrivateEngine>> engines;
+
+            while (engines.size() < maxParallel)
+            {
+                auto engine = std::make_unique<PrivateEngine> (modelFile, modelBlockSize, backend, loadOptions);
+
+                if (! engine->isLoaded())
+                    return table;
+
+                if (modelBlockSize % engine->getModelRatio() != 0)
+                    break;
+
+                engines.push_back (std::move (engine));
+            }
+
+            if (engines.size() < maxParallel)
+                continue;
+
+            for (auto parallel : parallelCandidates)
+            {
+                std::vector<Measurement> results (parallel);
+                std::vector<std::thread> threads;
+
+                for (size_t i = 0; i < parallel; ++i)
+                    threads.emplace_back ([&, i]
+                                          {
+                                              juce::Random random ((juce::int64) i);
+
+                                              for (int block = -numWarmUpBlocks; block < numBlocks; ++block)
+                                              {
+                                                  auto elapsed = engines[i]->process (random);
+
+                                                  if (block >= 0)
+                                                  {
+                                                      results[i].meanMs += elapsed / juce::jmax (1, numBlocks);
+                                                      results[i].maxMs = juce::jmax (results[i].maxMs, elapsed);
+                                                  }
+                                              }
+                                          });
+
+                for (auto& thread : threads)
+                    thread.join();
+
+                Measurement measurement { modelBlockSize, parallel };
+
+                for (auto& result : results)
+                {
+                    measurement.meanMs += result.meanMs / parallel;
+                    measurement.maxMs = juce::jmax (measurement.maxMs, result.maxMs);
+                }
+
+                table.push_back (measurement);
+            }
+        }
+
+        return table;
+    }
+
+    /// Rough latency of a setting, only used to rank them: the model block plus the time
+    /// anira waits for an inference, rounded up to whole host blocks
+    static int estimateLatency (const RAVERunSettings& settings, size_t hostBlockSize, double sampleRate)
+    {
+        auto hostBlock = juce::jmax ((size_t) 1, hostBlockSize);
+        auto waitSamples = (size_t) std::ceil (settings.max_inference_time * sampleRate / 1000.0);
+        return (int) (settings.block_size + (waitSamples + hostBlock - 1) / hostBlock * hostBlock);
+    }
+
+    /// Picks the setting with the lowest estimated latency that keeps up in real time.
+    /// A host block of B samples triggers max (1, B / M) inferences of M samples, and
+    /// with P of them in flight at once those must take on average no more than
+    /// headroom times P periods of max (B, M) samples. anira is then told to wait for
+    /// the slowest measured inference times safetyMargin. When nothing keeps up, the
+    /// setting with the most slack is used.
+    static RAVERunSettings choose (const Table& table, size_t hostBlockSize, double sampleRate, double headroom = 0.5, double safetyMargin = 1.5)
+    {
+        std::optional<RAVERunSettings> best;
+        RAVERunSettings fallback;
+        int bestLatency = INT_MAX;
+        double bestLoad = std::numeric_limits<double>::max();
+
+        for (auto& measurement : table)
+        {
+            RAVERunSettings settings { measurement.modelBlockSize, (float) (measurement.maxMs * safetyMargin), measurement.parallelProcessors };
+
+            auto numInferences = (double) juce::jmax ((size_t) 1, hostBlockSize / measurement.modelBlockSize);
+            auto periodMs = 1000.0 * (double) juce::jmax (hostBlockSize, measurement.modelBlockSize) / sampleRate;
+            auto load = numInferences * measurement.meanMs / (measurement.parallelProcessors * periodMs);
+
+            if (load <= headroom)
+            {
+                // Ties go to the fewest parallel processors, which come first in the table
+                if (auto latency = estimateLatency (settings, hostBlockSize, sampleRate); latency < bestLatency)
+                {
+                    bestLatency = latency;
+                    best = settings;
+                }
+            }
+            else if (load < bestLoad)
+            {
+                bestLoad = load;
+                fallback = settings;
+            }
+        }
+
+        return best.value_or (fallback);
+    }
+
+    /// Without measurements, the smallest candidate that covers a whole host block
+    static RAVERunSettings guess (size_t hostBlockSize, size_t modelRatio)
+    {
+        for (auto modelBlockSize : rave_block_size_candidates)
+            if (modelBlockSize >= hostBlockSize && modelBlockSize % modelRatio == 0)
+                return modelBlockSize;
+
+        return rave_default_block_size;
+    }
+
+    /// Identifies a set of measurements: the model file as it is on disk, how it is run
+    /// and the machine running it
+    static juce::String getKey (const juce::File& modelFile, const juce::String& backendType, RAVEProcessor::LoadOptions options)
+    {
+        auto id = modelFile.getFullPathName() + "|" + juce::String (modelFile.getLastModificationTime().toMilliseconds())
+                + "|" + backendType + (options.optimize ? "|optimized" : "") + (options.quantized ? "|int8" : "")
+                + "|" + NeuralBenchmark::describe (InferenceThreading::get())
+                + "|" + juce::SystemStats::getCpuModel() + "|" + juce::String (juce::SystemStats::getNumCpus());
+
+        return "calibration_" + juce::String::toHexString (id.hashCode64());
+    }
+
+    static juce::String toString (const Table& table)
+    {
+        juce::StringArray entries;
+
+        for (auto& m : table)
+            entries.add (juce::String (m.modelBlockSize) + "," + juce::String (m.parallelProcessors) + ","
+                         + juce::String (m.meanMs, 4) + "," + juce::String (m.maxMs, 4));
+
+        return entries.joinIntoString (";");
+    }
+
+    static Table fromString (const juce::String& text)
+    {
+        Table table;
+
+        for (auto& entry : juce::StringArray::fromTokens (text, ";", {}))
+        {
+            auto fields = juce::StringArray::fromTokens (entry, ",", {});
+
+            if (fields.size() != 4)
+                return {};
+
+            table.push_back ({ (size_t) fields[0].getLargeIntValue(), (unsigned int) fields[1].getIntValue(), fields[2].getDoubleValue(), fields[3].getDoubleValue() });
+        }
+
+        return table;
+    }
+};
+
+//==============================================================================
+/// Process-wide store of calibration tables, kept in memory and in a settings file so
+/// that each model is only measured once per machine, however many plugin instances
+/// load it. Hold it through a juce::SharedResourcePointer<NeuralCalibrationCache>.
+struct NeuralCalibrationCache
+{
+    NeuralCalibrationCache()
+        : settingsFile (getFileOptions())
+    {
+    }
+
+    std::optional<NeuralCalibration::Table> find (const juce::String& key)
+    {
+        const juce::ScopedLock sl (lock);
+
+        if (auto existing = tables.find (key); existing != tables.end())
+            return existing->second;
+
+        auto table = NeuralCalibration::fromString (settingsFile.getValue (key));
+
+        if (table.empty())
+            return std::nullopt;
+
+        tables[key] = table;
+        return table;
+    }
+
+    void store (const juce::String& key, const NeuralCalibration::Table& table)
+    {
+        const juce::ScopedLock sl (lock);
+        tables[key] = table;
+
+        settingsFile.setValue (key, NeuralCalibration::toString (table));
+        settingsFile.saveIfNeeded();
+    }
+
+private:
+    static juce::PropertiesFile::Options getFileOptions()
+    {
+        juce::PropertiesFile::Options options;
+        options.applicationName = JucePlugin_Name "Calibration";
+        options.folderName = JucePlugin_Manufacturer;
+        options.filenameSuffix = ".settings";
+        options.osxLibrarySubFolder = "Application Support";
+        options.millisecondsBeforeSaving = -1; // saved straight away by store()
+        return options;
+    }
+
+    juce::CriticalSection lock;
+    std::map<juce::String, NeuralCalibration::Table> tables;
+    juce::PropertiesFile settingsFile;
+};
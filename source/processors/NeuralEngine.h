@@ -0,0 +1,127 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <numeric>
+
+#include "../neural_configs/RAVE.h"
+#include "../neural_configs/RAVEPrePostProcessor.h"
+#include "../utils/Misc.h"
+
+//==============================================================================
+/// One loaded model, ready to run: its inference config, the custom RAVE backend
+/// and the anira handler driving it. The NeuralProcessor owns the engine in use
+/// and can build a replacement on a background thread while it keeps running.
+struct NeuralEngine
+{
+    explicit NeuralEngine (const anira::InferenceConfig& config, juce::File file, RAVEProcessor::LoadOptions options = {}, juce::File morph = {})
+        : inferenceConfig (config)
+        , loadOptions (options)
+        , morphFile (std::move (morph))
+        , modelFile (std::move (file))
+        , modelName (modelFile.getFileNameWithoutExtension())
+    {
+    }
+
+    void prepare (const anira::HostAudioConfig& hostConfig)
+    {
+        inferenceHandler.prepare (hostConfig);
+        inferenceHandler.set_inference_backend (backend.load());
+
+        // anira only drops the wet signal once an inference runs past its maximum
+        // inference time; one model block is what a sustained stream can afford
+        raveProcessor.getMonitor().setDeadline ((double) inferenceConfig.m_max_inference_time / 1000.0);
+        raveProcessor.getMonitor().setBlockDuration ((double) getModelBlockSize() / hostConfig.m_host_sample_rate);
+        raveProcessor.getMonitor().reset();
+    }
+
+    void process (juce::dsp::AudioBlock<SampleType> block)
+    {
+        float* channels[rave_num_audio_channels];
+
+        for (size_t channel = 0; channel < rave_num_audio_channels; ++channel)
+            channels[channel] = block.getChannelPointer (channel);
+
+        inferenceHandler.process (channels, block.getNumSamples());
+    }
+
+    int getLatency() { return (int) inferenceHandler.get_latency(); }
+
+    /// Samples per channel in each inference, i.e. the block size of the model's tensor shape
+    size_t getModelBlockSize() const
+    {
+        return inferenceConfig.m_input_sizes[inferenceConfig.m_index_audio_data[anira::Input]] / rave_num_audio_channels;
+    }
+
+    RAVERunSettings getRunSettings() const
+    {
+        return { getModelBlockSize(), inferenceConfig.m_max_inference_time, (unsigned int) inferenceConfig.m_num_parallel_processors };
+    }
+
+    /// Model blocks must be a multiple of the model's compression ratio, and of the
+    /// morph model's too when there is one
+    size_t getModelRatio() const
+    {
+        auto ratio = getRatio (raveProcessor.getModel());
+
+        if (auto* morph = raveProcessor.getMorphModel())
+            ratio = std::lcm (ratio, getRatio (*morph));
+
+        return ratio;
+    }
+
+    bool isMorphing() const { return raveProcessor.getMorphModel() != nullptr; }
+
+    //==============================================================================
+    /// Maps an entry of NeuralParameters::backendTypes to the backend that runs it.
+    /// LibTorch goes through the custom RAVEProcessor rather than anira's own one.
+    static anira::InferenceBackend getBackendForChoice (const juce::String& backendType)
+    {
+#ifdef USE_ONNXRUNTIME
+        if (backendType == "ONNXRUNTIME")
+            return anira::ONNX;
+#endif
+#ifdef USE_TFLITE
+        if (backendType == "TFLITE")
+            return anira::TFLITE;
+#endif
+        juce::ignoreUnused (backendType);
+        return anira::CUSTOM;
+    }
+
+    bool canUseBackend (anira::InferenceBackend newBackend) const
+    {
+        return hasModelFor (inferenceConfig, newBackend == anira::CUSTOM ? anira::LIBTORCH : newBackend);
+    }
+
+    /// Switches backend at runtime, falling back to LibTorch when this model has no
+    /// export for the requested one. Safe to call from the audio thread.
+    void setBackend (anira::InferenceBackend newBackend)
+    {
+        if (! canUseBackend (newBackend))
+            newBackend = anira::CUSTOM;
+
+        if (backend.exchange (newBackend) != newBackend)
+            inferenceHandler.set_inference_backend (newBackend);
+    }
+
+    anira::InferenceBackend getBackend() const { return backend.load(); }
+
+    anira::InferenceConfig inferenceConfig;
+    const RAVEProcessor::LoadOptions loadOptions;
+    const juce::File morphFile; // blended in by the morph parameter; empty for none
+    RAVEProcessor raveProcessor { inferenceConfig, loadOptions, morphFile.getFullPathName().toStdString() };
+    RAVEPrePostProcessor prePostProcessor { inferenceConfig };
+    anira::InferenceHandler inferenceHandler { prePostProcessor, inferenceConfig, raveProcessor, anira::ContextConfig (InferenceThreading::getNumInferenceThreads()) };
+    const juce::File modelFile;
+    const juce::String modelName;
+
+private:
+    static size_t getRatio (const RAVEProcessor::Model& model)
+    {
+        return model.loaded && model.encode_params.defined() ? (size_t) juce::jmax (1, model.getModelRatio()) : 1;
+    }
+
+    std::atomic<anira::InferenceBackend> backend { anira::CUSTOM };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (NeuralEngine)
+};
@@ -1,54 +1,151 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include <optional>
 
 #include "../neural_configs/RAVE.h"
+#include "./NeuralBenchmark.h"
+#include "./NeuralCalibration.h"
+#include "./NeuralEngine.h"
+#include "./NeuralWorkerClient.h"
+#include "./PriorGenerator.h"
+#include "./RAVEStreamingEngine.h"
 #include "../utils/Parameters.h"
+#include "../utils/Components.h"
+#include "../utils/PolyphaseResampler.h"
 
 //==============================================================================
 class NeuralProcessor : private juce::AudioProcessorParameter::Listener
+    , private juce::Timer
+    , public juce::ChangeBroadcaster
 
 {
 public:
     NeuralProcessor (const NeuralParameters& p)
         : parameters (p)
-        , inferenceHandler (prePostProcessor, inferenceConfig, raveProcessor)
+        , engine (std::make_unique<NeuralEngine> (RAVEConfig, juce::File (rave_default_model_path)))
         , dryWetMixer (32768) // 32768 samples of max latency compensation for the dry-wet mixer
     {
         parameters.neuralDryWet.addListener (this);
-        // parameters.neuralBackend.addListener (this);
+        parameters.neuralMode.addListener (this);
+        parameters.latentBias.addListener (this);
+        parameters.latentScale.addListener (this);
+        parameters.latentFreeze.addListener (this);
+        parameters.neuralBackend.addListener (this);
+        parameters.priorTemperature.addListener (this);
+        parameters.morph.addListener (this);
+        parameters.morphMode.addListener (this);
+
+        activeEngine.store (engine.get());
+        modelStatus = engine->modelName;
+        startTimerHz (10);
     }
 
     ~NeuralProcessor() override
     {
+        stopTimer();
+        loaderPool.removeAllJobs (true, -1);
+        delete pendingEngine.exchange (nullptr);
+        delete retiredEngine.exchange (nullptr);
+        delete pendingWorker.exchange (nullptr);
+        delete retiredWorker.exchange (nullptr);
+        delete pendingGenerator.exchange (nullptr);
+        delete retiredGenerator.exchange (nullptr);
+        delete pendingStreamingEngine.exchange (nullptr);
+        delete retiredStreamingEngine.exchange (nullptr);
+
         parameters.neuralDryWet.removeListener (this);
-        // parameters.neuralBackend.removeListener (this);
+        parameters.neuralMode.removeListener (this);
+        parameters.latentBias.removeListener (this);
+        parameters.latentScale.removeListener (this);
+        parameters.latentFreeze.removeListener (this);
+        parameters.neuralBackend.removeListener (this);
+        parameters.priorTemperature.removeListener (this);
+        parameters.morph.removeListener (this);
+        parameters.morphMode.removeListener (this);
     }
 
     //==============================================================================
     void prepare (const juce::dsp::ProcessSpec& spec)
     {
-        juce::dsp::ProcessSpec monoSpec { spec.sampleRate,
-                                          static_cast<juce::uint32> (spec.maximumBlockSize),
-                                          static_cast<juce::uint32> (1) };
+        juce::dsp::ProcessSpec inferenceSpec { spec.sampleRate,
+                                               static_cast<juce::uint32> (spec.maximumBlockSize),
+                                               static_cast<juce::uint32> (numInferenceChannels) };
 
-        anira::HostAudioConfig monoConfig {
-            (size_t) spec.maximumBlockSize,
-            spec.sampleRate
+        // Playback is stopped, so a swap in progress can simply be completed here. The
+        // new engine is published first, so that no other thread sees the old one once
+        // it is destroyed.
+        if (incomingEngine != nullptr)
+        {
+            activeEngine.store (incomingEngine.get());
+            engine = std::move (incomingEngine);
+        }
+
+        // Everything from here on, up to the engines, runs at the internal rate
+        prepareResampling (spec);
+
+        anira::HostAudioConfig hostConfig {
+            (size_t) getMaxInternalBlockSize(),
+            internalRate
         };
 
-        dryWetMixer.prepare (monoSpec);
+        {
+            const juce::ScopedLock sl (hostConfigLock);
+            preparedHostConfig = hostConfig;
+            isPrepared = true;
+        }
+
+        dryWetMixer.prepare (inferenceSpec);
+
+        scratchBuffer.setSize ((int) numInferenceChannels, (int) spec.maximumBlockSize);
+        swapBuffer.setSize ((int) numInferenceChannels, getMaxInternalBlockSize());
+        crossfadeLength = juce::jmax ((size_t) 1, (size_t) (internalRate * crossfadeSeconds));
+        silenceTailLength = (size_t) (internalRate * silenceTailSeconds);
+        resetSilenceGate();
 
-        monoBuffer.setSize (1, spec.maximumBlockSize);
-        inferenceHandler.prepare (monoConfig);
-        inferenceHandler.set_inference_backend (anira::CUSTOM);
+        // A running worker was set up for the old block size and sample rate
+        activeWorker.store (nullptr);
+        worker.reset();
+        delete pendingWorker.exchange (nullptr);
 
-        auto newLatency = inferenceHandler.get_latency();
+        // Likewise for a generator, which is restarted by the timer at the new sample rate
+        activeGenerator.store (nullptr);
+        generator.reset();
+        delete pendingGenerator.exchange (nullptr);
+        generatorUpdateNeeded.store (true);
 
-        dryWetMixer.setWetLatency (newLatency);
+        // And for a streaming engine, whose FIFOs are sized for the host block
+        activeStreamingEngine.store (nullptr);
+        streamingEngine.reset();
+        delete pendingStreamingEngine.exchange (nullptr);
+
+        engine->prepare (hostConfig);
+        activeEngine.store (engine.get());
+
+        if (auto pending = pendingEngine.exchange (nullptr))
+        {
+            pending->prepare (hostConfig);
+            delete pendingEngine.exchange (pending);
+        }
+
+        setWetLatency (engine->getLatency());
 
         parameterValueChanged (parameters.neuralDryWet.getParameterIndex(), parameters.neuralDryWet.get());
-        // parameterValueChanged (parameters.neuralBackend.getParameterIndex(), parameters.neuralBackend.getIndex());
+        updateLatentControls();
+        updateBackend();
+
+        // If the new host block size calls for other run settings, the current engine keeps
+        // playing while one with those settings is loaded in the background and swapped in
+        if (! matches (chooseRunSettings (engine->modelFile, engine->getModelRatio()), *engine))
+            loadModel (engine->modelFile);
+        else
+            calibrate (engine->modelFile);
+
+        if (useWorkerProcess.load())
+            startWorker();
+
+        if (useStreamingEngine.load())
+            startStreamingEngine();
     }
 
     void reset()
@@ -57,29 +154,301 @@ public:
 
     void process (juce::dsp::ProcessContextReplacing<SampleType>& context)
     {
-        auto numChannels = context.getInputBlock().getNumChannels();
-        auto numSamples = context.getInputBlock().getNumSamples();
+        auto block = context.getOutputBlock();
 
-        float* dataToReferTo[numChannels];
+        if (block.getNumChannels() >= numInferenceChannels)
+        {
+            processInference (block.getSubsetChannelBlock (0, numInferenceChannels));
+            return;
+        }
+
+        // Mono hosts feed the same signal to both model channels and get the average back
+        auto scratch = juce::dsp::AudioBlock<SampleType> (scratchBuffer).getSubBlock (0, block.getNumSamples());
 
-        for (unsigned int idx = 0; idx < numChannels; ++idx)
+        for (size_t channel = 0; channel < numInferenceChannels; ++channel)
+            scratch.getSingleChannelBlock (channel).copyFrom (block.getSingleChannelBlock (0));
+
+        processInference (scratch);
+
+        block.getSingleChannelBlock (0)
+            .replaceWithSumOf (scratch.getSingleChannelBlock (0), scratch.getSingleChannelBlock (1))
+            .multiplyBy (1.0f / (float) numInferenceChannels);
+    }
+
+    //==============================================================================
+    /// Loads a TorchScript model on a background thread, warms it up and then
+    /// crossfades to it from the audio thread. The new latency is reported through
+    /// onLatencyChanged once the switch is complete.
+    void loadModel (const juce::File& modelFile)
+    {
+        setModelStatus ("Loading " + modelFile.getFileName() + "...");
+
+        loaderPool.addJob ([this, modelFile, morphFile = morphModelFile]
+                           {
+                               auto makeEngine = [this, &modelFile, &morphFile] (const RAVERunSettings& runSettings)
+                               {
+                                   return std::make_unique<NeuralEngine> (makeRAVEConfig (modelFile.getFullPathName().toStdString(), numWarmUpPasses, runSettings),
+                                                                          modelFile,
+                                                                          getLoadOptions(),
+                                                                          morphFile);
+                               };
+
+                               auto newEngine = makeEngine (chooseRunSettings (modelFile, 1));
+
+                               if (! newEngine->raveProcessor.getModel().loaded)
+                               {
+                                   setModelStatus ("Failed to load " + modelFile.getFileName());
+                                   return;
+                               }
+
+                               // The model's ratio is only known once it is loaded
+                               if (auto runSettings = chooseRunSettings (modelFile, newEngine->getModelRatio()); ! matches (runSettings, *newEngine))
+                                   newEngine = makeEngine (runSettings);
+
+                               {
+                                   const juce::ScopedLock sl (hostConfigLock);
+
+                                   if (isPrepared)
+                                       newEngine->prepare (preparedHostConfig);
+                               }
+
+                               applyLatentControls (newEngine->raveProcessor);
+                               newEngine->setBackend (getSelectedBackend());
+                               delete pendingEngine.exchange (newEngine.release());
+                           });
+
+        calibrate (modelFile);
+    }
+
+    /// Loads a second model to morph towards with the morph parameter, next to the current
+    /// one, and swaps both in together like loadModel does. Both run on every inference,
+    /// concurrently, so morphing costs CPU but no extra latency. Only in-process engines
+    /// morph; the worker, streaming engine and generator run the main model alone.
+    /// Pass an empty file to stop morphing. Message thread.
+    void setMorphModel (const juce::File& file)
+    {
+        morphModelFile = file;
+
+        if (auto e = activeEngine.load())
+            loadModel (e->modelFile);
+    }
+
+    const juce::File& getMorphModel() const { return morphModelFile; }
+
+    /// Times every backend available for the current model on a background thread
+    /// and shows the results in the model status.
+    void benchmarkBackends()
+    {
+        auto e = activeEngine.load();
+
+        if (e == nullptr)
         {
-            dataToReferTo[idx] = context.getOutputBlock().getChannelPointer (idx);
+            setModelStatus ("Load a model to benchmark first");
+            return;
         }
 
-        auto buffer = juce::AudioBuffer<SampleType> (dataToReferTo, numChannels, numSamples);
+        auto modelFile = e->modelFile;
+        setModelStatus ("Benchmarking " + modelFile.getFileName() + "...");
+
+        loaderPool.addJob ([this, modelFile]
+                           {
+                               anira::HostAudioConfig hostConfig { 512, 48000.0 };
+
+                               {
+                                   const juce::ScopedLock sl (hostConfigLock);
+
+                                   if (isPrepared)
+                                       hostConfig = preparedHostConfig;
+                               }
+
+                               auto results = NeuralBenchmark::run (modelFile, hostConfig.m_host_sample_rate, (int) hostConfig.m_host_buffer_size);
+                               auto variants = NeuralBenchmark::compareLoadOptions (modelFile, hostConfig.m_host_sample_rate);
+                               auto summary = NeuralBenchmark::toString (results) + " || " + NeuralBenchmark::toString (variants);
+                               DBG ("Neural backend benchmark for " << modelFile.getFileName() << ": " << summary);
+                               setModelStatus (summary);
+                           });
+    }
+
+    /// Runs numTracks copies of the current model at once under a range of threading
+    /// settings, and writes the results to a report in the temp folder
+    void benchmarkThreading (int numTracks = 8)
+    {
+        auto e = activeEngine.load();
+
+        if (e == nullptr)
+        {
+            setModelStatus ("Load a model to benchmark first");
+            return;
+        }
+
+        auto modelFile = e->modelFile;
+        setModelStatus ("Benchmarking threading with " + juce::String (numTracks) + " tracks...");
+
+        loaderPool.addJob ([this, modelFile, numTracks]
+                           {
+                               anira::HostAudioConfig hostConfig { 512, 48000.0 };
+
+                               {
+                                   const juce::ScopedLock sl (hostConfigLock);
+
+                                   if (isPrepared)
+                                       hostConfig = preparedHostConfig;
+                               }
+
+                               auto results = NeuralBenchmark::compareThreading (modelFile,
+                                                                                 hostConfig.m_host_sample_rate,
+                                                                                 (int) hostConfig.m_host_buffer_size,
+                                                                                 numTracks,
+                                                                                 NeuralBenchmark::getThreadingCandidates (numTracks));
+
+                               auto report = juce::File::getSpecialLocation (juce::File::tempDirectory).getChildFile ("neural-threading-benchmark.txt");
+                               report.replaceWithText (NeuralBenchmark::toString (results).replace (" | ", "\n"));
+                               DBG ("Neural threading benchmark: " << NeuralBenchmark::toString (results));
+                               setModelStatus ("Threading benchmark written to " + report.getFullPathName());
+                           });
+    }
+
+    /// Applies new process-wide threading settings and reloads the current model so
+    /// that its processor is rebuilt with them
+    void setThreadingOptions (const InferenceThreadingOptions& options)
+    {
+        InferenceThreading::set (options);
+
+        if (auto e = activeEngine.load())
+            loadModel (e->modelFile);
+    }
+
+    /// Changes how models are loaded and reloads the current one with the new options
+    void setLoadOptions (RAVEProcessor::LoadOptions options)
+    {
+        optimizeModels.store (options.optimize);
+        useQuantizedModels.store (options.quantized);
+        useBatchedInference.store (options.batched);
+
+        if (auto e = activeEngine.load())
+            loadModel (e->modelFile);
+    }
+
+    RAVEProcessor::LoadOptions getLoadOptions() const
+    {
+        return { optimizeModels.load(), useQuantizedModels.load(), useBatchedInference.load() };
+    }
+
+    /// Moves inference into a separate NeuralWorker process, optionally pinned to the
+    /// given cpus (e.g. "2,3"), or back into the plugin. Message thread.
+    void setUseWorkerProcess (bool shouldUseWorker, const juce::String& cpus = {})
+    {
+        useWorkerProcess.store (shouldUseWorker);
+        workerCpus = cpus;
+
+        if (shouldUseWorker)
+            startWorker();
+        else
+            workerStopRequested.store (true);
+    }
+
+    bool isUsingWorkerProcess() const { return useWorkerProcess.load(); }
+
+    /// Runs inference at the given rate instead of the model's own, e.g. a lower one to
+    /// save CPU at the cost of a shifted spectrum. 0 goes back to the model's rate. Takes
+    /// effect the next time the host prepares the plugin. Message thread.
+    void setInternalSampleRate (double rate) { internalRateOverride.store (rate); }
+
+    /// The rate inference currently runs at
+    double getInternalSampleRate() const { return internalRate; }
+
+    /// Runs the current model through a RAVEStreamingEngine instead of anira, in chunks
+    /// of about chunkSize samples, or goes back to anira. Message thread.
+    void setUseStreamingEngine (bool shouldStream, int chunkSize = 2048)
+    {
+        useStreamingEngine.store (shouldStream);
+        streamingChunkSize = chunkSize;
+
+        if (shouldStream)
+            startStreamingEngine();
+        else
+            streamingStopRequested.store (true);
+    }
+
+    bool isUsingStreamingEngine() const { return useStreamingEngine.load(); }
+
+    /// Blocks the streaming engine didn't deliver in time, if one is in use. Message thread only.
+    juce::uint64 getStreamingUnderruns() const
+    {
+        if (auto s = activeStreamingEngine.load())
+            return s->getNumUnderruns();
+
+        return 0;
+    }
+
+    /// True while the generate mode is playing audio sampled from the model's prior
+    bool isGenerating() const { return activeGenerator.load() != nullptr; }
+
+    /// Generated audio waiting to be played, and blocks the audio thread found it
+    /// short of. Message thread only.
+    juce::String describeGenerator() const
+    {
+        if (auto g = activeGenerator.load())
+            return "generating, " + juce::String (g->getBufferedSeconds(), 1) + " s ahead, underruns " + juce::String (g->getNumUnderruns());
+
+        return {};
+    }
+
+    /// True while sustained input silence has stopped inference
+    bool isSilenceGated() const { return gatedState.load(); }
 
-        stereoToMono (monoBuffer, buffer);
-        dryWetMixer.pushDrySamples (monoBuffer);
+    /// Blocks the worker process didn't deliver in time, if one is in use. Message thread only.
+    juce::uint64 getWorkerUnderruns() const
+    {
+        if (auto w = activeWorker.load())
+            return w->getNumUnderruns();
+
+        return 0;
+    }
 
-        auto inferenceBuffer = const_cast<float**> (monoBuffer.getArrayOfWritePointers());
-        inferenceHandler.process (inferenceBuffer, (size_t) buffer.getNumSamples());
+    /// Inference timings of the model in use, or nothing when there are none to show:
+    /// only the LibTorch backend is timed, anira's own ONNX and TFLite ones aren't.
+    /// Message thread only.
+    std::optional<InferenceMonitor::Snapshot> getInferenceStats() const
+    {
+        if (auto e = activeEngine.load(); e != nullptr && e->getBackend() == anira::CUSTOM)
+            return e->raveProcessor.getMonitor().getSnapshot();
 
-        dryWetMixer.mixWetSamples (monoBuffer);
-        monoToStereo (buffer, monoBuffer);
+        return std::nullopt;
     }
 
-    anira::InferenceManager& getInferenceManager() { return inferenceHandler.get_inference_manager(); }
+    static juce::String describe (const std::optional<InferenceMonitor::Snapshot>& stats)
+    {
+        if (! stats.has_value())
+            return "Inference timings are only measured on LibTorch";
+
+        if (stats->count == 0)
+            return "No inferences yet";
+
+        return "mean " + juce::String (stats->getMeanMs(), 2) + " ms, p99 " + juce::String (stats->getPercentileMs (0.99), 2)
+             + " ms, max " + juce::String (stats->getMaxMs(), 2) + " ms | missed " + juce::String (stats->missed) + " / "
+             + juce::String (stats->count) + " (deadline " + juce::String ((double) stats->deadline_us / 1000.0, 2)
+             + " ms), over a block " + juce::String (stats->over_block) + " (" + juce::String ((double) stats->block_us / 1000.0, 2)
+             + " ms) | queue " + juce::String (stats->in_flight) + " (max " + juce::String (stats->max_in_flight) + ")";
+    }
+
+    juce::String getModelStatus() const
+    {
+        const juce::ScopedLock sl (statusLock);
+        return modelStatus;
+    }
+
+    int getLatency() const { return currentLatency.load(); }
+
+    std::function<void (int)> onLatencyChanged;
+
+    /// Called on the message thread when a model trained at another rate has been swapped
+    /// in, so that the resamplers no longer match it. The owner should call prepare()
+    /// again, with audio processing suspended. Without it, the new rate is only picked
+    /// up the next time the host prepares the plugin.
+    std::function<void()> onInternalRateChanged;
+
+    const NeuralParameters& parameters;
 
 private:
     void parameterGestureChanged (int parameterIndex, bool gestureIsStarting) override {}
@@ -90,81 +459,871 @@ private:
         {
             dryWetMixer.setWetMixProportion (newValue);
         }
+        else if (parameterIndex == parameters.neuralBackend.getParameterIndex())
+        {
+            updateBackend();
+        }
+        else
+        {
+            updateLatentControls();
+
+            // Generators are started and stopped by the timer, as this may be the audio thread
+            if (parameterIndex == parameters.neuralMode.getParameterIndex())
+                generatorUpdateNeeded.store (true);
+        }
+    }
+
+    anira::InferenceBackend getSelectedBackend() const
+    {
+        return NeuralEngine::getBackendForChoice (parameters.neuralBackend.getCurrentChoiceName());
     }
 
-    void stereoToMono (juce::AudioBuffer<float>& targetMonoBlock, juce::AudioBuffer<float>& sourceBlock)
+    void updateBackend()
     {
-        if (sourceBlock.getNumChannels() == 1)
+        if (auto e = activeEngine.load())
+            e->setBackend (getSelectedBackend());
+    }
+
+    void updateLatentControls()
+    {
+        if (auto e = activeEngine.load())
+            applyLatentControls (e->raveProcessor);
+
+        priorControls.temperature.store (parameters.priorTemperature.get());
+        priorControls.bias.store (parameters.latentBias.get());
+        priorControls.scale.store (parameters.latentScale.get());
+    }
+
+    void applyLatentControls (RAVEProcessor& processor)
+    {
+        auto& controls = processor.getLatentControls();
+        controls.splitEncodeDecode.store (parameters.neuralMode.getIndex() == splitModeIndex);
+        controls.bias.store (parameters.latentBias.get());
+        controls.scale.store (parameters.latentScale.get());
+        controls.freeze.store (parameters.latentFreeze.get());
+        controls.morph.store (parameters.morph.get());
+        controls.morphLatents.store (parameters.morphMode.getIndex() == 1);
+    }
+
+    // All channels are inferred in place, batched into a single forward call
+    void processInference (juce::dsp::AudioBlock<SampleType> block)
+    {
+        dryWetMixer.pushDrySamples (block);
+
+        if (isResampling)
+            runEnginesResampled (block);
+        else
+            runEngines (block);
+
+        dryWetMixer.mixWetSamples (block);
+    }
+
+    //==============================================================================
+    // Sample rate conversion. Models only sound right at the rate they were trained at,
+    // so inference runs at the model's own rate (or at internalRateOverride, e.g. a lower
+    // one to save CPU), with the host's audio converted to it and back. The number of
+    // internal samples per host block varies by one either way, so converted output goes
+    // through a short FIFO, primed with a few samples of silence so that it never runs dry.
+    void prepareResampling (const juce::dsp::ProcessSpec& spec)
+    {
+        hostRate = spec.sampleRate;
+        internalRate = internalRateOverride.load() > 0.0 ? internalRateOverride.load() : (double) engine->raveProcessor.getModel().sr;
+        isResampling = engine->raveProcessor.getModel().loaded && std::abs (internalRate - hostRate) >= 1.0;
+
+        if (! isResampling)
         {
-            targetMonoBlock.makeCopyOf (sourceBlock);
+            internalRate = hostRate;
+            maxInternalBlockSize = (int) spec.maximumBlockSize;
+            resamplerLatency = 0;
+            return;
         }
-        else
+
+        toInternalRate.prepare (hostRate, internalRate, (int) numInferenceChannels, (int) spec.maximumBlockSize);
+        maxInternalBlockSize = toInternalRate.getMaxOutputSamples ((int) spec.maximumBlockSize);
+        fromInternalRate.prepare (internalRate, hostRate, (int) numInferenceChannels, maxInternalBlockSize);
+
+        internalBuffer.setSize ((int) numInferenceChannels, maxInternalBlockSize);
+        resampledBuffer.setSize ((int) numInferenceChannels, (int) spec.maximumBlockSize + fromInternalRate.getMaxOutputSamples (maxInternalBlockSize) + resampledPriming);
+        resampledBuffer.clear();
+        resampledCount = resampledPriming;
+
+        // Both filters' delays, in host samples, plus the priming
+        resamplerLatency = (int) std::ceil (toInternalRate.getLatencyInInputSamples()
+                                            + fromInternalRate.getLatencyInInputSamples() * hostRate / internalRate)
+                         + resampledPriming;
+    }
+
+    int getMaxInternalBlockSize() const { return maxInternalBlockSize; }
+
+    void runEnginesResampled (juce::dsp::AudioBlock<SampleType> block)
+    {
+        auto numSamples = (int) block.getNumSamples();
+        auto internalBlock = juce::dsp::AudioBlock<SampleType> (internalBuffer);
+        auto numInternal = toInternalRate.process (block, internalBlock);
+        internalBlock = internalBlock.getSubBlock (0, (size_t) numInternal);
+
+        if (numInternal > 0)
+            runEngines (internalBlock);
+
+        auto fifoBlock = juce::dsp::AudioBlock<SampleType> (resampledBuffer);
+        resampledCount += fromInternalRate.process (internalBlock, fifoBlock.getSubBlock ((size_t) resampledCount));
+
+        auto numReady = juce::jmin (numSamples, resampledCount);
+        block.copyFrom (fifoBlock.getSubBlock (0, (size_t) numReady));
+
+        if (numReady < numSamples)
+            block.getSubBlock ((size_t) numReady).clear();
+
+        for (int channel = 0; channel < resampledBuffer.getNumChannels(); ++channel)
+        {
+            auto* data = resampledBuffer.getWritePointer (channel);
+            std::copy (data + numReady, data + resampledCount, data);
+        }
+
+        resampledCount -= numReady;
+    }
+
+    // Engine latencies are in internal samples; the host and the dry path want host samples
+    void setWetLatency (int internalLatency)
+    {
+        auto newLatency = (int) std::round (internalLatency * hostRate / internalRate) + resamplerLatency;
+        dryWetMixer.setWetLatency ((float) newLatency);
+        currentLatency.store (newLatency);
+    }
+
+    void runEngines (juce::dsp::AudioBlock<SampleType> block)
+    {
+        if (runGenerator (block))
+            return;
+
+        if (runStreamingEngine (block))
+            return;
+
+        if (runWorker (block))
+            return;
+
+        if (incomingEngine == nullptr && retiredEngine.load() == nullptr)
+        {
+            if (auto pending = pendingEngine.exchange (nullptr))
+            {
+                incomingEngine.reset (pending);
+                incomingEngine->setBackend (getSelectedBackend());
+                preRollRemaining = (size_t) juce::jmax (0, incomingEngine->getLatency());
+                crossfadeRemaining = crossfadeLength;
+            }
+        }
+
+        if (incomingEngine == nullptr)
+        {
+            runGatedEngine (block);
+            return;
+        }
+
+        auto numSamples = block.getNumSamples();
+        auto incomingBlock = juce::dsp::AudioBlock<SampleType> (swapBuffer).getSubBlock (0, numSamples);
+        incomingBlock.copyFrom (block);
+
+        engine->process (block);
+        incomingEngine->process (incomingBlock);
+
+        // Let the incoming engine fill its pipeline before it becomes audible
+        if (preRollRemaining > 0)
+        {
+            preRollRemaining -= juce::jmin (preRollRemaining, numSamples);
+            return;
+        }
+
+        auto fadePosition = crossfadeLength - crossfadeRemaining;
+        auto numFading = juce::jmin (numSamples, crossfadeRemaining);
+
+        for (size_t channel = 0; channel < numInferenceChannels; ++channel)
         {
-            auto nSamples = sourceBlock.getNumSamples();
+            auto* out = block.getChannelPointer (channel);
+            auto* in = incomingBlock.getChannelPointer (channel);
+
+            for (size_t i = 0; i < numSamples; ++i)
+            {
+                auto gain = i < numFading ? (float) (fadePosition + i + 1) / (float) crossfadeLength : 1.0f;
+                out[i] += gain * (in[i] - out[i]);
+            }
+        }
 
-            auto monoWrite = targetMonoBlock.getWritePointer (0);
-            auto lRead = sourceBlock.getReadPointer (0);
-            auto rRead = sourceBlock.getReadPointer (1);
+        crossfadeRemaining -= numFading;
 
-            juce::FloatVectorOperations::copy (monoWrite, lRead, nSamples);
-            juce::FloatVectorOperations::add (monoWrite, rRead, nSamples);
-            juce::FloatVectorOperations::multiply (monoWrite, 0.5f, nSamples);
+        if (crossfadeRemaining == 0)
+        {
+            retiredEngine.store (engine.release());
+            engine = std::move (incomingEngine);
+            activeEngine.store (engine.get());
+            resetSilenceGate();
+
+            setWetLatency (engine->getLatency());
+            swapCompleted.store (true);
         }
     }
 
-    void monoToStereo (juce::AudioBuffer<float>& targetStereoBlock, juce::AudioBuffer<float>& sourceBlock)
+    //==============================================================================
+    // Run settings selection. How fast a model runs is measured per model, backend and
+    // machine in the background and kept in the calibration cache, which outlives the
+    // plugin. Until a model has been measured, its block size is guessed from the host
+    // block size alone, and it is reloaded with the measured best settings as soon as
+    // the measurements come in.
+    juce::String getCalibrationKey (const juce::File& modelFile) const
+    {
+        return NeuralCalibration::getKey (modelFile, parameters.neuralBackend.getCurrentChoiceName(), getLoadOptions());
+    }
+
+    RAVERunSettings chooseRunSettings (const juce::File& modelFile, size_t modelRatio)
     {
-        if (targetStereoBlock.getNumChannels() == 1)
+        anira::HostAudioConfig hostConfig { rave_default_block_size, 48000.0 };
+
         {
-            targetStereoBlock.makeCopyOf (sourceBlock);
+            const juce::ScopedLock sl (hostConfigLock);
+
+            if (isPrepared)
+                hostConfig = preparedHostConfig;
         }
+
+        if (auto table = calibrationCache->find (getCalibrationKey (modelFile)))
+            return NeuralCalibration::choose (*table, hostConfig.m_host_buffer_size, hostConfig.m_host_sample_rate);
+
+        return NeuralCalibration::guess (hostConfig.m_host_buffer_size, modelRatio);
+    }
+
+    static bool matches (const RAVERunSettings& settings, const NeuralEngine& e)
+    {
+        auto current = e.getRunSettings();
+
+        return settings.block_size == current.block_size
+            && (settings.num_parallel_processors == 0 || settings.num_parallel_processors == current.num_parallel_processors)
+            && std::abs (settings.max_inference_time - current.max_inference_time) < 0.5f;
+    }
+
+    void calibrate (const juce::File& modelFile)
+    {
+        loaderPool.addJob ([this, modelFile]
+                           {
+                               auto key = getCalibrationKey (modelFile);
+
+                               if (calibrationCache->find (key))
+                                   return;
+
+                               setModelStatus ("Calibrating " + modelFile.getFileNameWithoutExtension() + "...");
+
+                               auto table = NeuralCalibration::measure (modelFile, getSelectedBackend(), getLoadOptions());
+
+                               if (! table.empty())
+                                   calibrationCache->store (key, table);
+
+                               calibrationFinished.store (true);
+                           });
+    }
+
+    void updateRunSettings()
+    {
+        auto e = activeEngine.load();
+
+        if (e == nullptr)
+            return;
+
+        if (! matches (chooseRunSettings (e->modelFile, e->getModelRatio()), *e))
+            loadModel (e->modelFile);
         else
+            setModelStatus (describeEngine (*e));
+    }
+
+    juce::String describeEngine (const NeuralEngine& e) const
+    {
+        auto settings = e.getRunSettings();
+        auto description = e.modelName + " (" + juce::String (settings.block_size) + " samples, " + juce::String (settings.num_parallel_processors)
+                         + " parallel, " + juce::String (settings.max_inference_time, 1) + " ms max inference";
+
+        if (isResampling)
+            description << ", at " << juce::String (internalRate / 1000.0, 1) << " kHz";
+
+        if (e.isMorphing())
+            description << ", morphing with " << e.morphFile.getFileNameWithoutExtension()
+                        << (e.raveProcessor.canMorphLatents() ? "" : " (outputs only)");
+
+        if (needsInternalRateChange (e))
+            description << ", trained at " << juce::String ((double) e.raveProcessor.getModel().sr / 1000.0, 1) << " kHz until the next prepare";
+
+        return description + ")";
+    }
+
+    // The internal rate is chosen in prepare(), so an engine swapped in later may not match it
+    bool needsInternalRateChange (const NeuralEngine& e) const
+    {
+        auto modelRate = (double) e.raveProcessor.getModel().sr;
+        auto expectedRate = std::abs (modelRate - hostRate) >= 1.0 ? modelRate : hostRate;
+
+        return internalRateOverride.load() <= 0.0 && modelRate > 0.0 && std::abs (expectedRate - internalRate) >= 1.0;
+    }
+
+    //==============================================================================
+    // Out-of-process inference. Workers are started on the loader thread and handed to
+    // the audio thread like engines are; the one in use, if any, replaces the engines
+    // entirely. The timer watches it, and if the process dies the audio thread falls
+    // back to the in-process engine.
+    void startWorker()
+    {
+        auto e = activeEngine.load();
+
+        if (e == nullptr)
+            return;
+
+        NeuralWorkerClient::Settings settings;
+        settings.modelFile = e->modelFile;
+        settings.loadOptions = e->loadOptions;
+        settings.modelBlockSize = e->getModelBlockSize();
+        settings.maxInferenceTime = e->getRunSettings().max_inference_time;
+        settings.parallelProcessors = e->getRunSettings().num_parallel_processors;
+        settings.cpus = workerCpus;
+
+        {
+            const juce::ScopedLock sl (hostConfigLock);
+
+            if (! isPrepared)
+                return;
+
+            settings.hostBlockSize = preparedHostConfig.m_host_buffer_size;
+            settings.sampleRate = preparedHostConfig.m_host_sample_rate;
+        }
+
+        setModelStatus ("Starting neural worker...");
+
+        loaderPool.addJob ([this, settings]
+                           {
+                               auto client = std::make_unique<NeuralWorkerClient> (settings);
+
+                               if (auto result = client->start(); result.failed())
+                               {
+                                   setModelStatus (result.getErrorMessage());
+                                   return;
+                               }
+
+                               setModelStatus (settings.modelFile.getFileNameWithoutExtension() + " (worker process)");
+                               delete pendingWorker.exchange (client.release());
+                           });
+    }
+
+    // Returns true if the block was handled by a worker process
+    bool runWorker (juce::dsp::AudioBlock<SampleType> block)
+    {
+        if (retiredWorker.load() == nullptr)
         {
-            auto nSamples = sourceBlock.getNumSamples();
+            auto pending = pendingWorker.exchange (nullptr);
+
+            if (pending != nullptr || (workerStopRequested.exchange (false) && worker != nullptr))
+            {
+                retiredWorker.store (worker.release());
+                worker.reset (pending);
+                activeWorker.store (pending);
+
+                setWetLatency (worker != nullptr ? worker->getLatency() : engine->getLatency());
+                latencyChanged.store (true);
+            }
+        }
 
-            auto lWrite = targetStereoBlock.getWritePointer (0);
-            auto rWrite = targetStereoBlock.getWritePointer (1);
-            auto monoRead = sourceBlock.getReadPointer (0);
+        if (worker == nullptr)
+            return false;
 
-            juce::FloatVectorOperations::copy (lWrite, monoRead, nSamples);
-            juce::FloatVectorOperations::copy (rWrite, monoRead, nSamples);
+        // The in-process engine isn't heard while a worker runs, so a newly loaded one
+        // is switched to straight away; the timer then restarts the worker with it
+        if (incomingEngine == nullptr && retiredEngine.load() == nullptr)
+        {
+            if (auto pending = pendingEngine.exchange (nullptr))
+            {
+                retiredEngine.store (engine.release());
+                engine.reset (pending);
+                activeEngine.store (pending);
+                resetSilenceGate();
+                swapCompleted.store (true);
+            }
         }
+
+        worker->process (block);
+        return true;
+    }
+
+    //==============================================================================
+    // Generate mode. A PriorGenerator samples and decodes on its own thread, well ahead
+    // of playback; the audio thread only copies its output. Generators are created and
+    // deleted on the message thread and handed over like workers, and the one in use
+    // replaces both the worker and the engines.
+    void updateGenerator()
+    {
+        auto e = activeEngine.load();
+
+        if (parameters.neuralMode.getIndex() != generateModeIndex || e == nullptr || ! PriorGenerator::canGenerate (e->raveProcessor.getModel()))
+        {
+            if (e != nullptr && parameters.neuralMode.getIndex() == generateModeIndex)
+                setModelStatus (e->modelName + " has no prior to generate from");
+
+            delete pendingGenerator.exchange (nullptr);
+            generatorStopRequested.store (true);
+            return;
+        }
+
+        if (auto g = activeGenerator.load(); g != nullptr && g->isUsing (e->raveProcessor.getModel()))
+            return;
+
+        double sampleRate = 0.0;
+
+        {
+            const juce::ScopedLock sl (hostConfigLock);
+
+            if (! isPrepared)
+                return;
+
+            sampleRate = preparedHostConfig.m_host_sample_rate;
+        }
+
+        auto newGenerator = std::make_unique<PriorGenerator> (e->raveProcessor.getSharedModel(), priorControls);
+        newGenerator->start (sampleRate);
+
+        generatorStopRequested.store (false);
+        delete pendingGenerator.exchange (newGenerator.release());
+    }
+
+    // Returns true if the block was filled by a generator
+    bool runGenerator (juce::dsp::AudioBlock<SampleType> block)
+    {
+        if (retiredGenerator.load() == nullptr)
+        {
+            auto pending = pendingGenerator.exchange (nullptr);
+
+            if (pending != nullptr || (generatorStopRequested.exchange (false) && generator != nullptr))
+            {
+                activeGenerator.store (pending);
+                retiredGenerator.store (generator.release());
+                generator.reset (pending);
+            }
+        }
+
+        if (generator == nullptr)
+            return false;
+
+        generator->read (block);
+        return true;
+    }
+
+    //==============================================================================
+    // Streaming engine. Like workers, it is loaded on the loader thread, handed to the
+    // audio thread through atomics and replaces the anira engines while in use. A newly
+    // loaded model is switched to straight away and the timer restarts the streaming
+    // engine with it.
+    void startStreamingEngine()
+    {
+        auto e = activeEngine.load();
+        int maxBlockSize = 0;
+
+        {
+            const juce::ScopedLock sl (hostConfigLock);
+
+            if (e == nullptr || ! isPrepared)
+                return;
+
+            maxBlockSize = (int) preparedHostConfig.m_host_buffer_size;
+        }
+
+        setModelStatus ("Starting the streaming engine...");
+
+        loaderPool.addJob ([this, modelFile = e->modelFile, maxBlockSize, chunkSize = streamingChunkSize]
+                           {
+                               auto newEngine = std::make_unique<RAVEStreamingEngine> (modelFile);
+
+                               if (! newEngine->isLoaded())
+                               {
+                                   setModelStatus ("The streaming engine could not load " + modelFile.getFileName());
+                                   return;
+                               }
+
+                               newEngine->start (maxBlockSize, chunkSize);
+                               setModelStatus (modelFile.getFileNameWithoutExtension() + " (streaming, " + juce::String (newEngine->getChunkSize()) + " sample chunks)");
+                               delete pendingStreamingEngine.exchange (newEngine.release());
+                           });
+    }
+
+    // Returns true if the block was handled by a streaming engine
+    bool runStreamingEngine (juce::dsp::AudioBlock<SampleType> block)
+    {
+        if (retiredStreamingEngine.load() == nullptr)
+        {
+            auto pending = pendingStreamingEngine.exchange (nullptr);
+
+            if (pending != nullptr || (streamingStopRequested.exchange (false) && streamingEngine != nullptr))
+            {
+                activeStreamingEngine.store (pending);
+                retiredStreamingEngine.store (streamingEngine.release());
+                streamingEngine.reset (pending);
+
+                setWetLatency (streamingEngine != nullptr ? streamingEngine->getLatency() : worker != nullptr ? worker->getLatency() : engine->getLatency());
+                latencyChanged.store (true);
+            }
+        }
+
+        if (streamingEngine == nullptr)
+            return false;
+
+        if (incomingEngine == nullptr && retiredEngine.load() == nullptr)
+        {
+            if (auto pending = pendingEngine.exchange (nullptr))
+            {
+                retiredEngine.store (engine.release());
+                engine.reset (pending);
+                activeEngine.store (pending);
+                resetSilenceGate();
+                swapCompleted.store (true);
+            }
+        }
+
+        streamingEngine->process (block);
+        return true;
+    }
+
+    //==============================================================================
+    // Silence gate. Once the input has been silent for long enough that the model's
+    // output has fully decayed (its latency plus a tail), the wet output is faded out
+    // and the model is no longer run. Nothing is pushed into or pulled out of anira
+    // while gated, so its buffers keep their fill level and the latency stays aligned.
+    // When sound returns, what anira had queued before the gate closed is muted for
+    // one latency period, which is exactly when the new input starts coming out.
+    void runGatedEngine (juce::dsp::AudioBlock<SampleType> block)
+    {
+        auto numSamples = block.getNumSamples();
+        auto range = block.findMinAndMax();
+        auto inputIsSilent = juce::jmax (std::abs (range.getStart()), std::abs (range.getEnd())) < silenceThreshold;
+
+        silentSamples = inputIsSilent ? silentSamples + numSamples : 0;
+
+        auto canGate = ! canSoundWithoutInput();
+
+        if (isGated)
+        {
+            if (inputIsSilent && canGate)
+            {
+                block.clear();
+                return;
+            }
+
+            isGated = false;
+            gatedState.store (false);
+            staleSamplesRemaining = (size_t) juce::jmax (0, engine->getLatency());
+        }
+
+        engine->process (block);
+
+        if (staleSamplesRemaining > 0)
+        {
+            auto numStale = juce::jmin (staleSamplesRemaining, numSamples);
+            block.getSubBlock (0, numStale).clear();
+            staleSamplesRemaining -= numStale;
+        }
+
+        if (canGate && silentSamples >= (size_t) juce::jmax (0, engine->getLatency()) + silenceTailLength)
+        {
+            for (size_t channel = 0; channel < block.getNumChannels(); ++channel)
+            {
+                auto* out = block.getChannelPointer (channel);
+
+                for (size_t i = 0; i < numSamples; ++i)
+                    out[i] *= 1.0f - (float) (i + 1) / (float) numSamples;
+            }
+
+            isGated = true;
+            gatedState.store (true);
+        }
+    }
+
+    // Settings under which the model keeps sounding on silent input: a frozen latent,
+    // a latent bias in split mode, or a morph towards another model
+    bool canSoundWithoutInput() const
+    {
+        return parameters.latentFreeze.get()
+            || (parameters.neuralMode.getIndex() == splitModeIndex && parameters.latentBias.get() != 0.0f)
+            || (parameters.morph.get() > 0.0f && engine->isMorphing());
+    }
+
+    void resetSilenceGate()
+    {
+        isGated = false;
+        gatedState.store (false);
+        silentSamples = 0;
+        staleSamplesRemaining = 0;
+    }
+
+    void timerCallback() override
+    {
+        if (swapCompleted.exchange (false))
+        {
+            if (needsInternalRateChange (*activeEngine.load()) && onInternalRateChanged)
+                onInternalRateChanged();
+
+            setModelStatus (describeEngine (*activeEngine.load()));
+
+            if (onLatencyChanged)
+                onLatencyChanged (currentLatency.load());
+
+            if (useWorkerProcess.load())
+                startWorker();
+
+            generatorUpdateNeeded.store (true);
+        }
+
+        if (generatorUpdateNeeded.exchange (false))
+            updateGenerator();
+
+        if (calibrationFinished.exchange (false))
+            updateRunSettings();
+
+        if (latencyChanged.exchange (false) && onLatencyChanged)
+            onLatencyChanged (currentLatency.load());
+
+        if (auto w = activeWorker.load(); w != nullptr && ! w->isAlive() && ! workerStopRequested.load())
+        {
+            setModelStatus ("The neural worker stopped, running in the plugin");
+            useWorkerProcess.store (false);
+            workerStopRequested.store (true);
+        }
+
+        if (auto s = activeStreamingEngine.load(); s != nullptr && s->hasFailed() && ! streamingStopRequested.load())
+        {
+            setModelStatus ("The streaming engine failed, running on anira");
+            useStreamingEngine.store (false);
+            streamingStopRequested.store (true);
+        }
+
+        delete retiredWorker.exchange (nullptr);
+        delete retiredGenerator.exchange (nullptr);
+        delete retiredStreamingEngine.exchange (nullptr);
+
+        delete retiredEngine.exchange (nullptr);
+    }
+
+    void setModelStatus (const juce::String& newStatus)
+    {
+        {
+            const juce::ScopedLock sl (statusLock);
+            modelStatus = newStatus;
+        }
+
+        sendChangeMessage();
     }
 
 private:
-    const NeuralParameters& parameters;
-    juce::AudioBuffer<float> monoBuffer;
+    static constexpr size_t numInferenceChannels = rave_num_audio_channels;
+    static constexpr unsigned int numWarmUpPasses = 4;
+    static constexpr double crossfadeSeconds = 0.1;
+    static constexpr double silenceTailSeconds = 1.0;
+    static constexpr float silenceThreshold = 3.0e-5f; // about -90 dBFS
+    static constexpr int splitModeIndex = 1;               // in NeuralParameters::modes
+    static constexpr int generateModeIndex = 2;            // in NeuralParameters::modes
+    static constexpr int resampledPriming = 4;             // samples of slack in the resampled output FIFO
+
+    juce::AudioBuffer<float> scratchBuffer, swapBuffer;
+
+    // The engine in use and, during a swap, the one being crossfaded to are only
+    // touched by the audio thread. Loaded engines arrive through pendingEngine and
+    // replaced ones leave through retiredEngine, to be deleted on the message thread.
+    std::unique_ptr<NeuralEngine> engine, incomingEngine;
+    std::atomic<NeuralEngine*> pendingEngine { nullptr }, retiredEngine { nullptr }, activeEngine { nullptr };
+    std::atomic<bool> swapCompleted { false };
+    std::atomic<bool> optimizeModels { false }, useQuantizedModels { false }, useBatchedInference { false };
+
+    std::unique_ptr<NeuralWorkerClient> worker;
+    std::atomic<NeuralWorkerClient*> pendingWorker { nullptr }, retiredWorker { nullptr }, activeWorker { nullptr };
+    std::atomic<bool> useWorkerProcess { false }, workerStopRequested { false }, latencyChanged { false };
+    juce::String workerCpus;
+
+    std::unique_ptr<RAVEStreamingEngine> streamingEngine;
+    std::atomic<RAVEStreamingEngine*> pendingStreamingEngine { nullptr }, retiredStreamingEngine { nullptr }, activeStreamingEngine { nullptr };
+    std::atomic<bool> useStreamingEngine { false }, streamingStopRequested { false };
+    int streamingChunkSize = 2048;
+
+    PriorGenerator::Controls priorControls; // outlives the generators reading it
+    std::unique_ptr<PriorGenerator> generator;
+    std::atomic<PriorGenerator*> pendingGenerator { nullptr }, retiredGenerator { nullptr }, activeGenerator { nullptr };
+    std::atomic<bool> generatorStopRequested { false }, generatorUpdateNeeded { false };
+    std::atomic<int> currentLatency { 0 };
+
+    PolyphaseResampler toInternalRate, fromInternalRate;
+    juce::AudioBuffer<float> internalBuffer, resampledBuffer;
+    double hostRate = 48000.0, internalRate = 48000.0;
+    bool isResampling = false;
+    int maxInternalBlockSize = 0, resampledCount = 0, resamplerLatency = 0;
+    std::atomic<double> internalRateOverride { 0.0 };
+    size_t preRollRemaining = 0, crossfadeRemaining = 0, crossfadeLength = 1;
+
+    bool isGated = false;
+    std::atomic<bool> gatedState { false };
+    size_t silentSamples = 0, staleSamplesRemaining = 0, silenceTailLength = 0;
+
+    juce::CriticalSection hostConfigLock;
+    anira::HostAudioConfig preparedHostConfig;
+    bool isPrepared = false;
+
+    juce::SharedResourcePointer<NeuralCalibrationCache> calibrationCache;
+    std::atomic<bool> calibrationFinished { false };
+
+    juce::CriticalSection statusLock;
+    juce::String modelStatus;
 
-    anira::InferenceConfig inferenceConfig = RAVEConfig;
-    RAVEProcessor raveProcessor { inferenceConfig };
-    anira::PrePostProcessor prePostProcessor;
-    anira::InferenceHandler inferenceHandler;
     juce::dsp::DryWetMixer<float> dryWetMixer;
+    juce::ThreadPool loaderPool { 1 };
+    juce::File morphModelFile; // message thread
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (NeuralProcessor)
 };
 
 struct NeuralControls final : public juce::Component
+    , private juce::ChangeListener
+    , private juce::Timer
 {
-    explicit NeuralControls (juce::AudioProcessorEditor& editorIn, const NeuralParameters& parameters)
-        : sliderAttachment (parameters.neuralDryWet, dryWetSlider, nullptr)
+    explicit NeuralControls (juce::AudioProcessorEditor& editorIn, NeuralProcessor& np)
+        : neuralProcessor (np)
+        , backendType (editorIn, np.parameters.neuralBackend)
+        , sliderAttachment (np.parameters.neuralDryWet, dryWetSlider, nullptr)
+        , mode (editorIn, np.parameters.neuralMode)
+        , latentFreeze (editorIn, np.parameters.latentFreeze)
+        , latentBias (editorIn, np.parameters.latentBias)
+        , latentScale (editorIn, np.parameters.latentScale)
+        , priorTemperature (editorIn, np.parameters.priorTemperature)
+        , morph (editorIn, np.parameters.morph)
+        , morphMode (editorIn, np.parameters.morphMode)
 
     {
         sliderLabel.attachToComponent (&dryWetSlider, false);
         dryWetSlider.setSliderStyle (juce::Slider::SliderStyle::LinearBarVertical);
         addAndMakeVisible (dryWetSlider);
         addAndMakeVisible (sliderLabel);
+        addAllAndMakeVisible (*this, backendType, mode, latentFreeze, latentBias, latentScale, priorTemperature, morph, morphMode, loadModelButton, morphModelButton, benchmarkButton, optimizeToggle, quantizedToggle, batchedToggle, workerToggle, streamingToggle, modelLabel, statsLabel);
+
+        loadModelButton.onClick = [this]
+        {
+            chooseModelFile ([this] (const juce::File& file)
+                             { neuralProcessor.loadModel (file); });
+        };
+
+        morphModelButton.onClick = [this]
+        {
+            if (neuralProcessor.getMorphModel() == juce::File())
+            {
+                chooseModelFile ([this] (const juce::File& file)
+                                 { neuralProcessor.setMorphModel (file); });
+            }
+            else
+            {
+                juce::PopupMenu menu;
+                menu.addItem ("Morph with another model...", [this]
+                              { chooseModelFile ([this] (const juce::File& file)
+                                                 { neuralProcessor.setMorphModel (file); }); });
+                menu.addItem ("Stop morphing", [this] { neuralProcessor.setMorphModel ({}); });
+                menu.showMenuAsync (juce::PopupMenu::Options().withTargetComponent (morphModelButton));
+            }
+        };
+
+        benchmarkButton.onClick = [this]
+        {
+            juce::PopupMenu menu;
+            menu.addItem ("Backends and load options", [this] { neuralProcessor.benchmarkBackends(); });
+            menu.addItem ("Threading, 8 tracks", [this] { neuralProcessor.benchmarkThreading (8); });
+            menu.addItem ("Threading, 32 tracks", [this] { neuralProcessor.benchmarkThreading (32); });
+            menu.showMenuAsync (juce::PopupMenu::Options().withTargetComponent (benchmarkButton));
+        };
+
+        optimizeToggle.setToggleState (neuralProcessor.getLoadOptions().optimize, juce::dontSendNotification);
+        quantizedToggle.setToggleState (neuralProcessor.getLoadOptions().quantized, juce::dontSendNotification);
+        batchedToggle.setToggleState (neuralProcessor.getLoadOptions().batched, juce::dontSendNotification);
+        workerToggle.setToggleState (neuralProcessor.isUsingWorkerProcess(), juce::dontSendNotification);
+        workerToggle.onClick = [this]
+        {
+            neuralProcessor.setUseWorkerProcess (workerToggle.getToggleState());
+        };
+
+        streamingToggle.setToggleState (neuralProcessor.isUsingStreamingEngine(), juce::dontSendNotification);
+        streamingToggle.onClick = [this]
+        {
+            neuralProcessor.setUseStreamingEngine (streamingToggle.getToggleState());
+        };
+
+        optimizeToggle.onClick = quantizedToggle.onClick = batchedToggle.onClick = [this]
+        {
+            neuralProcessor.setLoadOptions ({ optimizeToggle.getToggleState(), quantizedToggle.getToggleState(), batchedToggle.getToggleState() });
+        };
+
+        modelLabel.setJustificationType (juce::Justification::centred);
+        neuralProcessor.addChangeListener (this);
+        changeListenerCallback (&neuralProcessor);
+
+        statsLabel.setJustificationType (juce::Justification::centred);
+        startTimerHz (4);
+    }
+
+    ~NeuralControls() override
+    {
+        neuralProcessor.removeChangeListener (this);
     }
 
-    void resized()
+    void resized() override
     {
         auto r = getLocalBounds();
+        auto modelArea = r.removeFromTop (30);
+        loadModelButton.setBounds (modelArea.removeFromRight (120).reduced (2));
+        morphModelButton.setBounds (modelArea.removeFromRight (120).reduced (2));
+        benchmarkButton.setBounds (modelArea.removeFromRight (120).reduced (2));
+        streamingToggle.setBounds (modelArea.removeFromRight (80).reduced (2));
+        workerToggle.setBounds (modelArea.removeFromRight (80).reduced (2));
+        batchedToggle.setBounds (modelArea.removeFromRight (80).reduced (2));
+        quantizedToggle.setBounds (modelArea.removeFromRight (70).reduced (2));
+        optimizeToggle.setBounds (modelArea.removeFromRight (90).reduced (2));
+        modelLabel.setBounds (modelArea);
+        statsLabel.setBounds (r.removeFromTop (20));
+        performLayout (r.removeFromBottom (getHeight() / 4), backendType, mode, latentFreeze, latentBias, latentScale, priorTemperature, morph, morphMode);
         dryWetSlider.setBounds (r.reduced ((float) getWidth() / 4.0f, (float) getHeight() / 6.0f));
     }
 
-    // AttachedCombo backendType;
+private:
+    void changeListenerCallback (juce::ChangeBroadcaster*) override
+    {
+        modelLabel.setText (neuralProcessor.getModelStatus(), juce::dontSendNotification);
+    }
+
+    void timerCallback() override
+    {
+        statsLabel.setText (NeuralProcessor::describe (neuralProcessor.getInferenceStats())
+                                + (neuralProcessor.isGenerating() ? " | " + neuralProcessor.describeGenerator() : "")
+                                + (neuralProcessor.isSilenceGated() ? " | gated (silence)" : "")
+                                + (neuralProcessor.isUsingWorkerProcess() ? " | worker underruns " + juce::String (neuralProcessor.getWorkerUnderruns()) : "")
+                                + (neuralProcessor.isUsingStreamingEngine() ? " | streaming underruns " + juce::String (neuralProcessor.getStreamingUnderruns()) : ""),
+                            juce::dontSendNotification);
+    }
+
+    void chooseModelFile (std::function<void (const juce::File&)> onChosen)
+    {
+        fileChooser = std::make_unique<juce::FileChooser> ("Load a RAVE model", juce::File (RAVE_MODELS_PATH_PYTORCH), "*.ts");
+        fileChooser->launchAsync (juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectFiles,
+                                  [onChosen] (const juce::FileChooser& chooser)
+                                  {
+                                      if (auto file = chooser.getResult(); file.existsAsFile())
+                                          onChosen (file);
+                                  });
+    }
+
+    NeuralProcessor& neuralProcessor;
+
+    AttachedCombo backendType;
     // AttachedSlider dryWet;
     juce::Slider dryWetSlider;
     juce::Label sliderLabel { "Dry/Wet" };
     juce::SliderParameterAttachment sliderAttachment;
+    AttachedCombo mode;
+    AttachedToggle latentFreeze;
+    AttachedSlider latentBias, latentScale, priorTemperature, morph;
+    AttachedCombo morphMode;
+
+    juce::TextButton loadModelButton { "Load model..." }, morphModelButton { "Morph with..." }, benchmarkButton { "Benchmark" };
+    juce::ToggleButton optimizeToggle { "Optimise" }, quantizedToggle { "Int8" }, batchedToggle { "Shared" }, workerToggle { "Worker" }, streamingToggle { "Stream" };
+    juce::Label modelLabel, statsLabel;
+    std::unique_ptr<juce::FileChooser> fileChooser;
 };
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "../neural_configs/NeuralWorkerProtocol.h"
+#include "../neural_configs/RAVE.h"
+#include "../utils/Misc.h"
+
+//==============================================================================
+/// Plugin side of the out-of-process inference mode.
+///
+/// Creates the shared-memory segment, launches the NeuralWorker executable on it and
+/// then exchanges audio with it through the lock-free rings: every block is written to
+/// the worker and the block it finished a callback earlier is read back. If the worker
+/// falls behind, crashes or is killed, the block comes back silent and is counted as an
+/// underrun; the host process is never affected.
+///
+/// The two rings are kept in step so that the wet signal stays at getLatency(): a block
+/// the worker has no room for is dropped along with the wet block it would have read,
+/// and a wet block that wasn't back in time is skipped once it arrives.
+class NeuralWorkerClient
+{
+public:
+    struct Settings
+    {
+        juce::File modelFile;
+        RAVEProcessor::LoadOptions loadOptions;
+        size_t modelBlockSize = rave_default_block_size;
+        float maxInferenceTime = rave_default_max_inference_time; // ms
+        unsigned int parallelProcessors = 0;
+        size_t hostBlockSize = 512;
+        double sampleRate = 48000.0;
+        juce::String cpus; // e.g. "2,3" to pin the worker to isolated cores; empty for no pinning
+    };
+
+    explicit NeuralWorkerClient (Settings s)
+        : settings (std::move (s))
+    {
+    }
+
+    ~NeuralWorkerClient()
+    {
+        if (sharedChannel.isOpen())
+            sharedChannel.getState().stop_requested.store (1);
+
+        if (workerProcess.isRunning() && ! workerProcess.waitForProcessToFinish (2000))
+            workerProcess.kill();
+    }
+
+    static juce::File getWorkerExecutable()
+    {
+#ifdef NEURAL_WORKER_PATH
+        if (juce::File worker (NEURAL_WORKER_PATH); worker.existsAsFile())
+            return worker;
+#endif
+        return juce::File::getSpecialLocation (juce::File::currentExecutableFile).getSiblingFile ("NeuralWorker");
+    }
+
+    /// Launches the worker and waits until it has loaded the model. Not for the audio thread.
+    juce::Result start (int timeoutMs = 30000)
+    {
+        static std::atomic<int> counter { 0 };
+        auto name = "/nwkr-" + std::to_string (juce::Process::getProcessID()) + "-" + std::to_string (counter++);
+        auto capacity = (uint32_t) juce::nextPowerOfTwo ((int) juce::jmax (settings.hostBlockSize, settings.modelBlockSize) * 8);
+
+        if (! sharedChannel.create (name, capacity, (uint32_t) rave_num_audio_channels))
+            return juce::Result::fail ("Could not create the shared memory for the neural worker");
+
+        juce::StringArray command { getWorkerExecutable().getFullPathName(),
+                                    "--shm", juce::String (name),
+                                    "--model", settings.modelFile.getFullPathName(),
+                                    "--block-size", juce::String (settings.hostBlockSize),
+                                    "--sample-rate", juce::String (settings.sampleRate),
+                                    "--model-block-size", juce::String (settings.modelBlockSize),
+                                    "--max-inference-time", juce::String (settings.maxInferenceTime) };
+
+        if (settings.parallelProcessors > 0)
+            command.addArray ({ "--parallel", juce::String (settings.parallelProcessors) });
+
+        if (settings.cpus.isNotEmpty())
+            command.addArray ({ "--cpus", settings.cpus });
+
+        if (settings.loadOptions.optimize)
+            command.add ("--optimize");
+
+        if (settings.loadOptions.quantized)
+            command.add ("--quantized");
+
+        if (! workerProcess.start (command, 0))
+            return juce::Result::fail ("Could not launch " + command[0]);
+
+        auto& state = sharedChannel.getState();
+        auto deadline = juce::Time::getMillisecondCounter() + (juce::uint32) timeoutMs;
+
+        while (state.ready.load() == 0)
+        {
+            if (state.failed.load() != 0 || ! workerProcess.isRunning())
+                return juce::Result::fail ("The neural worker could not run " + settings.modelFile.getFileName());
+
+            if (juce::Time::getMillisecondCounter() > deadline)
+                return juce::Result::fail ("The neural worker did not start in time");
+
+            juce::Thread::sleep (10);
+        }
+
+        latency = state.latency.load();
+        return juce::Result::ok();
+    }
+
+    /// Sends the block to the worker and replaces it with the wet signal. Audio thread only.
+    void process (juce::dsp::AudioBlock<SampleType> block)
+    {
+        auto numSamples = block.getNumSamples();
+        float* channels[rave_num_audio_channels];
+
+        for (size_t channel = 0; channel < rave_num_audio_channels; ++channel)
+            channels[channel] = block.getChannelPointer (channel);
+
+        if (! sharedChannel.getToWorker().write (channels, numSamples))
+        {
+            block.clear();
+            underruns.fetch_add (1, std::memory_order_relaxed);
+            return;
+        }
+
+        auto& fromWorker = sharedChannel.getFromWorker();
+
+        if (outputToSkip > 0)
+            outputToSkip -= fromWorker.skip (outputToSkip);
+
+        if (! fromWorker.read (channels, numSamples))
+        {
+            block.clear();
+            outputToSkip += numSamples;
+            underruns.fetch_add (1, std::memory_order_relaxed);
+        }
+    }
+
+    /// Total latency: the worker's anira latency plus the block it runs behind
+    int getLatency() const { return latency; }
+
+    juce::uint64 getNumUnderruns() const { return underruns.load(); }
+
+    /// False once the worker process has gone away. Message thread.
+    bool isAlive() const { return workerProcess.isRunning(); }
+
+    const Settings& getSettings() const { return settings; }
+
+private:
+    Settings settings;
+    neural_worker::SharedChannel sharedChannel;
+    mutable juce::ChildProcess workerProcess;
+    int latency = 0;
+    size_t outputToSkip = 0; // wet samples that came back too late to be played
+    std::atomic<juce::uint64> underruns { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (NeuralWorkerClient)
+};
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "../neural_configs/RAVE.h"
+#include "../utils/Misc.h"
+
+//==============================================================================
+/// Generative mode for models that come with a prior. A background thread samples
+/// latents from the prior, decodes them and writes the audio into a lock-free FIFO,
+/// keeping a few seconds ahead of playback. The audio thread only ever copies out of
+/// that FIFO, so generating costs it no inference time and can't run late.
+///
+/// The prior and decoder keep streaming state inside the scripted module, so the
+/// generator runs a clone of the model it is given, sharing its weights but not the
+/// buffers the engine's own inference updates.
+class PriorGenerator : private juce::Thread
+{
+public:
+    /// Set from the message thread, read by the generator thread before every chunk
+    struct Controls
+    {
+        std::atomic<float> temperature { 1.0f };
+        std::atomic<float> bias { 0.0f };
+        std::atomic<float> scale { 1.0f };
+    };
+
+    PriorGenerator (std::shared_ptr<const RAVEProcessor::Model> modelToClone, const Controls& controlsToUse)
+        : juce::Thread ("RAVE prior generator")
+        , source (modelToClone)
+        , model (std::make_shared<RAVEProcessor::Model> (std::move (modelToClone)))
+        , controls (controlsToUse)
+    {
+    }
+
+    ~PriorGenerator() override
+    {
+        stopThread (4000);
+    }
+
+    static bool canGenerate (const RAVEProcessor::Model& m)
+    {
+        return m.loaded && m.has_prior && m.decode_params.defined() && m.hasMethod ("prior") && m.hasMethod ("decode");
+    }
+
+    /// Sizes the FIFO to lookAheadSeconds of audio and starts filling it. Message thread.
+    void start (double sampleRate, double lookAheadSeconds = 2.0)
+    {
+        jassert (! isThreadRunning());
+
+        hostSampleRate = sampleRate;
+        auto capacity = juce::jmax (2 * chunkSize, (int) (sampleRate * lookAheadSeconds));
+        buffer.setSize ((int) rave_num_audio_channels, capacity);
+        buffer.clear();
+        fifo.setTotalSize (capacity);
+        fifo.reset();
+
+        primeLevel = capacity / 2;
+        primed.store (false);
+        underruns.store (0);
+
+        startThread (juce::Thread::Priority::normal);
+    }
+
+    /// Copies the next block of generated audio. Where the FIFO has run dry the block is
+    /// left silent, which only counts as an underrun once it has been filled up once.
+    /// Audio thread.
+    void read (juce::dsp::AudioBlock<SampleType> block)
+    {
+        auto numSamples = (int) block.getNumSamples();
+        auto numRead = juce::jmin (numSamples, fifo.getNumReady());
+
+        if (numRead > 0)
+        {
+            const auto scope = fifo.read (numRead);
+
+            for (size_t channel = 0; channel < block.getNumChannels(); ++channel)
+            {
+                auto source = (int) juce::jmin (channel, rave_num_audio_channels - 1);
+                auto* out = block.getChannelPointer (channel);
+
+                if (scope.blockSize1 > 0)
+                    juce::FloatVectorOperations::copy (out, buffer.getReadPointer (source, scope.startIndex1), scope.blockSize1);
+
+                if (scope.blockSize2 > 0)
+                    juce::FloatVectorOperations::copy (out + scope.blockSize1, buffer.getReadPointer (source, scope.startIndex2), scope.blockSize2);
+            }
+        }
+
+        if (numRead < numSamples)
+        {
+            block.getSubBlock ((size_t) numRead).clear();
+
+            if (primed.load (std::memory_order_relaxed))
+                underruns.fetch_add (1, std::memory_order_relaxed);
+        }
+    }
+
+    /// True if the generator was cloned from m
+    bool isUsing (const RAVEProcessor::Model& m) const { return source.get() == &m; }
+
+    /// Blocks the audio thread found the FIFO short of
+    juce::uint64 getNumUnderruns() const { return underruns.load(); }
+
+    /// Seconds of generated audio waiting to be played
+    double getBufferedSeconds() const { return (double) fifo.getNumReady() / hostSampleRate; }
+
+private:
+    void run() override
+    {
+        c10::InferenceMode guard;
+
+        while (! threadShouldExit())
+        {
+            // The audio thread doesn't signal reads, so the FIFO is polled
+            if (fifo.getFreeSpace() < chunkSize)
+            {
+                wait (20);
+                continue;
+            }
+
+            if (! generateChunk())
+                return;
+
+            if (fifo.getNumReady() >= primeLevel)
+                primed.store (true);
+        }
+    }
+
+    // Samples stepsPerChunk steps from the prior, decodes them and queues the audio
+    bool generateChunk()
+    {
+        try
+        {
+            std::vector<torch::jit::IValue> inputs { torch::ones ({ 1, 1, stepsPerChunk }) * controls.temperature.load() };
+            auto latent = model->m_module.get_method ("prior") (inputs).toTensor();
+
+            // Priors may model fewer dimensions than the decoder takes; the rest stay at zero
+            auto decoderDims = model->decode_params.index ({ 0 }).item<int64_t>();
+
+            if (latent.size (1) < decoderDims)
+                latent = torch::constant_pad_nd (latent, { 0, 0, 0, decoderDims - latent.size (1) });
+            else if (latent.size (1) > decoderDims)
+                latent = latent.narrow (1, 0, decoderDims);
+
+            latent = latent * controls.scale.load() + controls.bias.load();
+
+            inputs[0] = latent;
+            auto audio = model->m_module.get_method ("decode") (inputs).toTensor().contiguous();
+
+            auto numOutputChannels = audio.size (1);
+            auto numSamples = (int) juce::jmin ((int64_t) fifo.getFreeSpace(), audio.size (2));
+            const auto* data = audio.data_ptr<float>();
+            const auto scope = fifo.write (numSamples);
+
+            for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+            {
+                const auto* source = data + juce::jmin ((int64_t) channel, numOutputChannels - 1) * audio.size (2);
+
+                if (scope.blockSize1 > 0)
+                    buffer.copyFrom (channel, scope.startIndex1, source, scope.blockSize1);
+
+                if (scope.blockSize2 > 0)
+                    buffer.copyFrom (channel, scope.startIndex2, source + scope.blockSize1, scope.blockSize2);
+            }
+
+            return true;
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "[ERROR] prior generation failed: " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    static int getRatio (const RAVEProcessor::Model& m)
+    {
+        return m.encode_params.defined() ? juce::jmax (1, m.getModelRatio()) : 2048;
+    }
+
+    std::shared_ptr<const RAVEProcessor::Model> source;
+    std::shared_ptr<RAVEProcessor::Model> model;
+    const Controls& controls;
+
+    // Roughly 4096 samples per decode: small enough to keep the FIFO topped up
+    // smoothly, large enough that each call does a useful amount of work
+    const int64_t stepsPerChunk = juce::jmax (1, 4096 / getRatio (*model));
+    const int chunkSize = (int) stepsPerChunk * getRatio (*model);
+
+    juce::AbstractFifo fifo { 1 };
+    juce::AudioBuffer<float> buffer;
+    double hostSampleRate = 48000.0;
+    int primeLevel = 0;
+    std::atomic<bool> primed { false };
+    std::atomic<juce::uint64> underruns { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (PriorGenerator)
+};
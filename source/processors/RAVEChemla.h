@@ -243,6 +243,8 @@ public:
 
     bool isStereo() const { return stereo; }
 
+    bool isLoaded() const { return model_path.isNotEmpty(); }
+
     at::Tensor getLatentBuffer() { return latent_buffer; }
 
     bool hasMethod (const std::string& method_name) const
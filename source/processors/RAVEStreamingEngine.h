@@ -0,0 +1,250 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "../utils/Misc.h"
+#include "./RAVEChemla.h"
+
+//==============================================================================
+/// Lightweight alternative to the anira path: runs the RAVE class from RAVEChemla.h
+/// on its own inference thread, in chunks of any multiple of the model's ratio,
+/// whatever the host block size.
+///
+/// The audio thread pushes its input into one lock-free FIFO and pulls the wet signal
+/// out of another; the inference thread moves whole chunks from the first to the
+/// second through encode and decode. The two chunk tensors are allocated once and
+/// used in turn, so nothing is allocated per chunk and a tensor is never refilled
+/// while the model may still refer to it from the previous call.
+///
+/// The output FIFO starts with two chunks plus one host block of silence: one chunk
+/// to gather the input, one for the inference itself and a block because chunks only
+/// complete at block boundaries. That is the engine's latency.
+///
+/// Whenever a block can't go through whole, the FIFOs are kept in step so that the
+/// latency stays put: a block that doesn't fit in the input FIFO is dropped along with
+/// the output it would have read, and output that wasn't ready in time is skipped once
+/// it arrives.
+class RAVEStreamingEngine : private juce::Thread
+{
+public:
+    static constexpr int numChannels = 2;
+
+    explicit RAVEStreamingEngine (const juce::File& file)
+        : juce::Thread ("RAVE streaming engine")
+        , modelFile (file)
+    {
+        rave.load_model (modelFile.getFullPathName().toStdString());
+    }
+
+    ~RAVEStreamingEngine() override
+    {
+        stopThread (4000);
+    }
+
+    bool isLoaded() const { return rave.isLoaded(); }
+
+    /// Rounds a requested chunk size to a multiple of the model's ratio that lies in
+    /// the buffer sizes the model accepts
+    int getChunkSizeFor (int requestedSize)
+    {
+        auto ratio = juce::jmax (1, rave.getModelRatio());
+        auto range = rave.getValidBufferSizes();
+        auto chunks = juce::jlimit ((int) std::ceil (range.getStart() / (float) ratio),
+                                    juce::jmax (1, (int) range.getEnd() / ratio),
+                                    (requestedSize + ratio - 1) / ratio);
+        return chunks * ratio;
+    }
+
+    /// Allocates the FIFOs and tensors and starts the inference thread. Call once,
+    /// before the first process call.
+    void start (int maxBlockSize, int requestedChunkSize = 2048)
+    {
+        jassert (isLoaded() && ! isThreadRunning());
+
+        chunkSize = getChunkSizeFor (requestedChunkSize);
+        latency = 2 * chunkSize + maxBlockSize;
+
+        auto capacity = 4 * chunkSize + 2 * maxBlockSize;
+        inputBuffer.setSize (numChannels, capacity);
+        outputBuffer.setSize (numChannels, capacity);
+        outputBuffer.clear();
+        inputFifo.setTotalSize (capacity);
+        outputFifo.setTotalSize (capacity);
+        inputFifo.reset();
+        outputFifo.reset();
+        outputFifo.finishedWrite (latency);
+
+        {
+            c10::InferenceMode guard;
+
+            // Mono models take both channels as a batch of two, stereo ones as one
+            // two-channel example: either way the channels are laid out one after the other
+            auto shape = rave.isStereo() ? std::vector<int64_t> { 1, numChannels, chunkSize }
+                                         : std::vector<int64_t> { numChannels, 1, chunkSize };
+
+            for (auto& tensor : inputTensors)
+                tensor = torch::zeros (shape);
+        }
+
+        underruns.store (0);
+        failed.store (false);
+        outputToSkip = 0;
+        startThread (juce::Thread::Priority::high);
+    }
+
+    /// Replaces the block with the wet signal, delayed by getLatency(). Audio thread.
+    void process (juce::dsp::AudioBlock<SampleType> block)
+    {
+        auto numSamples = (int) block.getNumSamples();
+
+        // The inference thread has fallen behind: leaving the output unread too keeps
+        // as many samples in flight as before
+        if (inputFifo.getFreeSpace() < numSamples)
+        {
+            block.clear();
+            underruns.fetch_add (1, std::memory_order_relaxed);
+            return;
+        }
+
+        {
+            const auto scope = inputFifo.write (numSamples);
+
+            for (int channel = 0; channel < numChannels; ++channel)
+            {
+                auto* in = block.getChannelPointer ((size_t) juce::jmin (channel, (int) block.getNumChannels() - 1));
+
+                if (scope.blockSize1 > 0)
+                    inputBuffer.copyFrom (channel, scope.startIndex1, in, scope.blockSize1);
+
+                if (scope.blockSize2 > 0)
+                    inputBuffer.copyFrom (channel, scope.startIndex2, in + scope.blockSize1, scope.blockSize2);
+            }
+        }
+
+        // Output that missed its block would now come out late
+        if (outputToSkip > 0)
+        {
+            auto numSkipped = juce::jmin (outputToSkip, outputFifo.getNumReady());
+            outputFifo.finishedRead (numSkipped);
+            outputToSkip -= numSkipped;
+        }
+
+        auto numRead = juce::jmin (numSamples, outputFifo.getNumReady());
+
+        if (numRead > 0)
+        {
+            const auto scope = outputFifo.read (numRead);
+
+            for (size_t channel = 0; channel < block.getNumChannels(); ++channel)
+            {
+                auto source = (int) juce::jmin (channel, (size_t) numChannels - 1);
+                auto* out = block.getChannelPointer (channel);
+
+                if (scope.blockSize1 > 0)
+                    juce::FloatVectorOperations::copy (out, outputBuffer.getReadPointer (source, scope.startIndex1), scope.blockSize1);
+
+                if (scope.blockSize2 > 0)
+                    juce::FloatVectorOperations::copy (out + scope.blockSize1, outputBuffer.getReadPointer (source, scope.startIndex2), scope.blockSize2);
+            }
+        }
+
+        if (numRead < numSamples)
+        {
+            block.getSubBlock ((size_t) numRead).clear();
+            outputToSkip += numSamples - numRead;
+            underruns.fetch_add (1, std::memory_order_relaxed);
+        }
+    }
+
+    int getLatency() const { return latency; }
+
+    int getChunkSize() const { return chunkSize; }
+
+    /// Blocks the inference thread didn't deliver in time
+    juce::uint64 getNumUnderruns() const { return underruns.load(); }
+
+    /// True once inference has thrown: the thread has stopped and the engine only
+    /// produces silence from then on
+    bool hasFailed() const { return failed.load(); }
+
+    const juce::File modelFile;
+
+private:
+    void run() override
+    {
+        c10::InferenceMode guard;
+
+        while (! threadShouldExit())
+        {
+            // Polled rather than signalled, so that the audio thread never makes a system call
+            if (inputFifo.getNumReady() < chunkSize || outputFifo.getFreeSpace() < chunkSize)
+            {
+                wait (1);
+                continue;
+            }
+
+            auto& input = inputTensors[nextTensor];
+            nextTensor ^= 1;
+
+            {
+                const auto scope = inputFifo.read (chunkSize);
+                auto* data = input.data_ptr<float>();
+
+                for (int channel = 0; channel < numChannels; ++channel)
+                {
+                    auto* dest = data + channel * chunkSize;
+
+                    if (scope.blockSize1 > 0)
+                        juce::FloatVectorOperations::copy (dest, inputBuffer.getReadPointer (channel, scope.startIndex1), scope.blockSize1);
+
+                    if (scope.blockSize2 > 0)
+                        juce::FloatVectorOperations::copy (dest + scope.blockSize1, inputBuffer.getReadPointer (channel, scope.startIndex2), scope.blockSize2);
+                }
+            }
+
+            at::Tensor output;
+
+            try
+            {
+                output = rave.decode (rave.encode (input)).contiguous();
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "[ERROR] RAVE streaming inference failed: " << e.what() << std::endl;
+                failed.store (true);
+                return;
+            }
+
+            // Same layout as the input: mono output comes back as a batch of two
+            auto numOutputSamples = (int) juce::jmin ((int64_t) chunkSize, output.size (2));
+            auto numOutputChannels = (int) (output.size (0) * output.size (1));
+            auto* data = output.data_ptr<float>();
+            const auto scope = outputFifo.write (numOutputSamples);
+
+            for (int channel = 0; channel < numChannels; ++channel)
+            {
+                auto* source = data + juce::jmin (channel, numOutputChannels - 1) * output.size (2);
+
+                if (scope.blockSize1 > 0)
+                    outputBuffer.copyFrom (channel, scope.startIndex1, source, scope.blockSize1);
+
+                if (scope.blockSize2 > 0)
+                    outputBuffer.copyFrom (channel, scope.startIndex2, source + scope.blockSize1, scope.blockSize2);
+            }
+        }
+    }
+
+    RAVE rave;
+
+    int chunkSize = 0, latency = 0;
+    std::array<at::Tensor, 2> inputTensors;
+    int nextTensor = 0;
+
+    juce::AbstractFifo inputFifo { 1 }, outputFifo { 1 };
+    juce::AudioBuffer<float> inputBuffer, outputBuffer;
+    std::atomic<juce::uint64> underruns { 0 };
+    std::atomic<bool> failed { false };
+    int outputToSkip = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (RAVEStreamingEngine)
+};
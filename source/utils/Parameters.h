@@ -39,8 +39,15 @@ PARAMETER_ID (distortionHighpass)
 PARAMETER_ID (distortionInGain)
 PARAMETER_ID (distortionCompGain)
 PARAMETER_ID (distortionMix)
-// PARAMETER_ID (neuralBackend)
+PARAMETER_ID (neuralBackend)
 PARAMETER_ID (neuralDryWet)
+PARAMETER_ID (neuralMode)
+PARAMETER_ID (neuralLatentBias)
+PARAMETER_ID (neuralLatentScale)
+PARAMETER_ID (neuralLatentFreeze)
+PARAMETER_ID (neuralPriorTemperature)
+PARAMETER_ID (neuralMorph)
+PARAMETER_ID (neuralMorphMode)
 PARAMETER_ID (compressorEnabled)
 PARAMETER_ID (compressorThreshold)
 PARAMETER_ID (compressorRatio)
@@ -185,29 +192,86 @@ struct DistortionParameters
 
 struct NeuralParameters
 {
-    // inline static juce::StringArray backendTypes { "TFLITE", "LIBTORCH", "ONNXRUNTIME", "NONE" };
-    // inline static juce::String defaultBackend { backendTypes[2] };
+    inline static juce::StringArray backendTypes { "TFLITE", "LIBTORCH", "ONNXRUNTIME" };
+    inline static juce::String defaultBackend { backendTypes[1] };
 
     template <typename T>
     explicit NeuralParameters (T& layout)
-        : // : neuralBackend (addToLayout<juce::AudioParameterChoice> (
-        //     layout,
-        //     ID::neuralBackend,
-        //     "Backend type",
-        //     backendTypes,
-        //     backendTypes.indexOf (defaultBackend)))
-
-        neuralDryWet (addToLayout<Parameter> (
+        : neuralBackend (addToLayout<juce::AudioParameterChoice> (
             layout,
-            ID::neuralDryWet,
-            "Dry / Wet",
-            juce::NormalisableRange<float> (0.0f, 1.0f, 0.01f),
-            1.0f))
+            juce::ParameterID { ID::neuralBackend, 1 },
+            "Backend type",
+            backendTypes,
+            backendTypes.indexOf (defaultBackend)))
+        , neuralDryWet (addToLayout<Parameter> (
+              layout,
+              ID::neuralDryWet,
+              "Dry / Wet",
+              juce::NormalisableRange<float> (0.0f, 1.0f, 0.01f),
+              1.0f))
+        , neuralMode (addToLayout<juce::AudioParameterChoice> (
+              layout,
+              juce::ParameterID { ID::neuralMode, 1 },
+              "Neural Mode",
+              modes,
+              0))
+        , latentBias (addToLayout<Parameter> (
+              layout,
+              juce::ParameterID { ID::neuralLatentBias, 1 },
+              "Latent Bias",
+              juce::NormalisableRange<float> (-3.0f, 3.0f, 0.01f),
+              0.0f,
+              getBasicAttributes()))
+        , latentScale (addToLayout<Parameter> (
+              layout,
+              juce::ParameterID { ID::neuralLatentScale, 1 },
+              "Latent Scale",
+              juce::NormalisableRange<float> (0.0f, 4.0f, 0.01f),
+              1.0f,
+              getBasicAttributes()))
+        , latentFreeze (addToLayout<juce::AudioParameterBool> (
+              layout,
+              juce::ParameterID { ID::neuralLatentFreeze, 1 },
+              "Freeze",
+              false))
+        , priorTemperature (addToLayout<Parameter> (
+              layout,
+              juce::ParameterID { ID::neuralPriorTemperature, 1 },
+              "Prior Temperature",
+              juce::NormalisableRange<float> (0.0f, 2.0f, 0.01f),
+              1.0f,
+              getBasicAttributes()))
+        , morph (addToLayout<Parameter> (
+              layout,
+              juce::ParameterID { ID::neuralMorph, 1 },
+              "Morph",
+              juce::NormalisableRange<float> (0.0f, 1.0f, 0.01f),
+              0.0f,
+              getBasicAttributes()))
+        , morphMode (addToLayout<juce::AudioParameterChoice> (
+              layout,
+              juce::ParameterID { ID::neuralMorphMode, 1 },
+              "Morph Mode",
+              morphModes,
+              0))
     {
     }
 
-    // juce::AudioParameterChoice& neuralBackend;
+    // Generate ignores the input and plays what the model's prior comes up with
+    inline static juce::StringArray modes { "Forward", "Encode / Decode", "Generate" };
+
+    // Morphing towards a second model blends either the outputs or the latents
+    inline static juce::StringArray morphModes { "Output", "Latent" };
+
+    juce::AudioParameterChoice& neuralBackend;
     Parameter& neuralDryWet;
+    juce::AudioParameterChoice& neuralMode;
+    Parameter& latentBias;
+    Parameter& latentScale;
+    juce::AudioParameterBool& latentFreeze;
+    Parameter& priorTemperature;
+    Parameter& morph;
+    juce::AudioParameterChoice& morphMode;
 };
 
 struct FilterParameters
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <numeric>
+
+//==============================================================================
+/// Streaming sample rate converter for a rational ratio L / M (e.g. 147 / 160 for
+/// 48 kHz to 44.1 kHz).
+///
+/// A windowed-sinc lowpass at L times the input rate is split into L polyphase
+/// branches, so that every output sample is a single dot product of one branch with
+/// the latest input samples and no zero-stuffed samples are ever computed. Branch
+/// coefficients are stored time-reversed and each channel's history is kept twice in
+/// a row, so both operands of the dot product are contiguous, and the dot product
+/// runs on four independent accumulators so that the compiler can keep them in one
+/// SIMD register.
+class PolyphaseResampler
+{
+public:
+    /// Allocates everything the resampler needs for blocks of up to maxInputBlockSize
+    /// samples. tapsPerPhase is rounded up to a multiple of 4. Message thread.
+    void prepare (double inputRate, double outputRate, int numChannels, int maxInputBlockSize, int tapsPerPhase = 32)
+    {
+        auto in = (int) std::round (inputRate);
+        auto out = (int) std::round (outputRate);
+
+        // Unusual rates give huge ratios; rounding them to 100 Hz keeps the table small
+        if (out / std::gcd (in, out) > maxPhases)
+        {
+            in = juce::jmax (100, (in + 50) / 100 * 100);
+            out = juce::jmax (100, (out + 50) / 100 * 100);
+        }
+
+        auto divisor = std::gcd (in, out);
+        upFactor = out / divisor;
+        downFactor = in / divisor;
+        numTaps = (juce::jmax (4, tapsPerPhase) + 3) / 4 * 4;
+        maxInput = maxInputBlockSize;
+
+        designFilter();
+
+        history.setSize (numChannels, 2 * numTaps);
+        positions.assign ((size_t) numChannels, 0);
+        reset();
+    }
+
+    void reset()
+    {
+        history.clear();
+        std::fill (positions.begin(), positions.end(), 0);
+        phase = 0;
+    }
+
+    /// True when input and output rates are the same, i.e. there is nothing to do
+    bool isIdentity() const { return upFactor == downFactor; }
+
+    /// The most output samples a block of numInputSamples can produce
+    int getMaxOutputSamples (int numInputSamples) const
+    {
+        return (int) (((juce::int64) numInputSamples * upFactor + downFactor - 1) / downFactor) + 1;
+    }
+
+    /// Delay of the filter, in input samples
+    double getLatencyInInputSamples() const
+    {
+        return (double) (upFactor * numTaps - 1) / (2.0 * upFactor);
+    }
+
+    double getRatio() const { return (double) upFactor / (double) downFactor; }
+
+    /// Converts a block, writing as many output samples as it yields (at most
+    /// getMaxOutputSamples) to the start of output, and returns that number.
+    int process (const juce::dsp::AudioBlock<const float>& input, juce::dsp::AudioBlock<float> output)
+    {
+        jassert ((int) input.getNumSamples() <= maxInput);
+        jassert ((int) output.getNumSamples() >= getMaxOutputSamples ((int) input.getNumSamples()));
+
+        auto numInput = (int) input.getNumSamples();
+        auto numChannels = juce::jmin ((int) input.getNumChannels(), (int) output.getNumChannels(), history.getNumChannels());
+        auto startPhase = phase;
+        int numOutput = 0;
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            auto* in = input.getChannelPointer ((size_t) channel);
+            auto* out = output.getChannelPointer ((size_t) channel);
+            auto* lines = history.getWritePointer (channel);
+            auto& position = positions[(size_t) channel];
+
+            phase = startPhase;
+            numOutput = 0;
+
+            for (int i = 0; i < numInput; ++i)
+            {
+                lines[position] = lines[position + numTaps] = in[i];
+                position = position + 1 == numTaps ? 0 : position + 1;
+
+                // The newest numTaps samples, oldest first
+                auto* window = lines + position;
+
+                for (; phase < upFactor; phase += downFactor)
+                    out[numOutput++] = dot (coefficients.getData() + phase * numTaps, window);
+
+                phase -= upFactor;
+            }
+        }
+
+        return numOutput;
+    }
+
+private:
+    static constexpr int maxPhases = 1024;
+
+    // Kaiser-windowed sinc at upFactor times the input rate, cut off a little below
+    // half the lower of the two rates, split into time-reversed polyphase branches.
+    // Each branch is scaled to unity gain at DC, so that no phase adds a ripple.
+    void designFilter()
+    {
+        auto length = (size_t) (upFactor * numTaps);
+
+        // Half the lower rate, in cycles per sample at L times the input rate
+        auto cutoff = 0.5 * 0.92 / (double) juce::jmax (upFactor, downFactor);
+
+        std::vector<float> window (length);
+        juce::dsp::WindowingFunction<float>::fillWindowingTables (window.data(), length, juce::dsp::WindowingFunction<float>::kaiser, false, 8.0f);
+
+        coefficients.allocate (length, true);
+        auto centre = (double) (length - 1) / 2.0;
+
+        for (size_t k = 0; k < length; ++k)
+        {
+            auto x = 2.0 * cutoff * ((double) k - centre);
+            auto sinc = std::abs (x) < 1.0e-9 ? 1.0 : std::sin (juce::MathConstants<double>::pi * x) / (juce::MathConstants<double>::pi * x);
+
+            // Tap k belongs to branch k % L, as its (k / L)-th coefficient
+            auto branch = (int) k % upFactor;
+            auto tap = (int) k / upFactor;
+            coefficients[(size_t) (branch * numTaps + numTaps - 1 - tap)] = (float) sinc * window[k];
+        }
+
+        for (int branch = 0; branch < upFactor; ++branch)
+        {
+            auto* taps = coefficients.getData() + branch * numTaps;
+            auto sum = std::accumulate (taps, taps + numTaps, 0.0f);
+
+            if (std::abs (sum) > 1.0e-6f)
+                juce::FloatVectorOperations::multiply (taps, 1.0f / sum, numTaps);
+        }
+    }
+
+    float dot (const float* a, const float* b) const noexcept
+    {
+        float acc0 = 0.0f, acc1 = 0.0f, acc2 = 0.0f, acc3 = 0.0f;
+
+        for (int i = 0; i < numTaps; i += 4)
+        {
+            acc0 += a[i] * b[i];
+            acc1 += a[i + 1] * b[i + 1];
+            acc2 += a[i + 2] * b[i + 2];
+            acc3 += a[i + 3] * b[i + 3];
+        }
+
+        return (acc0 + acc1) + (acc2 + acc3);
+    }
+
+    int upFactor = 1, downFactor = 1, numTaps = 4, maxInput = 0, phase = 0;
+    juce::HeapBlock<float> coefficients;
+    juce::AudioBuffer<float> history;
+    std::vector<int> positions;
+
+    JUCE_LEAK_DETECTOR (PolyphaseResampler)
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <istream>
+#include <map>
+
+//==============================================================================
+/// Process-wide pool of memory-mapped sample files.
+///
+/// Sampler patches bind multi-sample WAV libraries to Cmajor `external` arrays.
+/// Rather than streaming each file through a private read buffer on every patch
+/// load, the patch reads them through a read-only mapping: the OS pages the file in
+/// on demand and every instance reads the same pages.
+///
+/// This only covers reading the files. Cmajor decodes an external array and copies
+/// it into the engine when it links the patch, and offers no way to bind one to
+/// memory it doesn't own, so each loaded patch still holds its own decoded samples.
+///
+/// Hold it through a juce::SharedResourcePointer<SampleLibrary> so that mappings
+/// live as long as at least one processor needs them.
+struct SampleLibrary
+{
+    using MappedFile = std::shared_ptr<const juce::MemoryMappedFile>;
+
+    static bool isSampleFile (const juce::File& file)
+    {
+        return file.hasFileExtension ("wav;wave;aif;aiff;flac");
+    }
+
+    /// Returns the shared mapping of a file, creating it if needed. Mappings are
+    /// keyed by path and modification time so that editing a sample on disk is
+    /// picked up by the next patch rebuild.
+    MappedFile getMappedFile (const juce::File& file)
+    {
+        auto key = file.getFullPathName() + "@" + juce::String (file.getLastModificationTime().toMilliseconds());
+
+        const juce::ScopedLock sl (lock);
+
+        if (auto existing = mappedFiles[key].lock())
+            return existing;
+
+        // Drop mappings nobody holds any more, including older versions of edited files
+        for (auto it = mappedFiles.begin(); it != mappedFiles.end();)
+            it = it->second.expired() ? mappedFiles.erase (it) : std::next (it);
+
+        auto mapped = std::make_shared<const juce::MemoryMappedFile> (file, juce::MemoryMappedFile::readOnly);
+
+        if (mapped->getData() == nullptr)
+        {
+            mappedFiles.erase (key);
+            return {};
+        }
+
+        mappedFiles[key] = mapped;
+        return mapped;
+    }
+
+    /// Creates a stream which reads straight out of the shared mapping, or
+    /// nullptr if the file can't be mapped.
+    std::shared_ptr<std::istream> createInputStream (const juce::File& file)
+    {
+        if (auto mapped = getMappedFile (file))
+            return std::make_shared<MappedInputStream> (std::move (mapped));
+
+        return {};
+    }
+
+private:
+    struct MappedStreamBuffer : public std::streambuf
+    {
+        explicit MappedStreamBuffer (const juce::MemoryMappedFile& file)
+        {
+            auto start = static_cast<char*> (file.getData());
+            setg (start, start, start + file.getSize());
+        }
+
+        pos_type seekoff (off_type offset, std::ios_base::seekdir dir, std::ios_base::openmode) override
+        {
+            auto base = dir == std::ios_base::beg ? eback()
+                      : dir == std::ios_base::cur ? gptr()
+                                                  : egptr();
+
+            return seekpos (pos_type ((base - eback()) + offset), std::ios_base::in);
+        }
+
+        pos_type seekpos (pos_type position, std::ios_base::openmode) override
+        {
+            if (position < 0 || position > pos_type (egptr() - eback()))
+                return pos_type (off_type (-1));
+
+            setg (eback(), eback() + (off_type) position, egptr());
+            return position;
+        }
+    };
+
+    struct MappedInputStream : public std::istream
+    {
+        explicit MappedInputStream (MappedFile f)
+            : std::istream (nullptr)
+            , file (std::move (f))
+            , buffer (*file)
+        {
+            rdbuf (&buffer);
+        }
+
+        MappedFile file;
+        MappedStreamBuffer buffer;
+    };
+
+    juce::CriticalSection lock;
+    std::map<juce::String, std::weak_ptr<const juce::MemoryMappedFile>> mappedFiles;
+};
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <JuceHeader.h>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <optional>
+
+//==============================================================================
+/// Golden-output regression checks. A fixed input (and MIDI) is rendered through a
+/// processing stage and compared sample by sample with a reference render stored as a
+/// 32-bit float WAV file, so that a kernel, quantisation or threading change can show
+/// that it is bit-exact, or within the stage's tolerance, before it ships.
+///
+/// References are named after the stage, sample rate and block size, so renders at
+/// different settings never get compared with each other.
+struct GoldenRender
+{
+    using Render = std::function<void (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midi)>;
+
+    struct Tolerance
+    {
+        float maxAbsoluteError = 0.0f; // 0 means bit-exact
+        double maxRmsError = 0.0;
+    };
+
+    struct Stage
+    {
+        juce::String name;
+        Render render;
+        Tolerance tolerance;
+    };
+
+    struct Comparison
+    {
+        bool bitExact = false;
+        bool withinTolerance = false;
+        float maxAbsoluteError = 0.0f;
+        double rmsError = 0.0;
+        int firstDifference = -1; // sample index, or -1 when bit-exact
+        juce::String error;       // set when the two renders can't be compared at all
+    };
+
+    //==============================================================================
+    /// The input every stage is rendered from: an exponential sine sweep, a train of
+    /// impulses, seeded noise and finally silence, so that tones, transients, broadband
+    /// material and tails are all covered. The same for a given rate and length.
+    static juce::AudioBuffer<float> makeInput (double sampleRate, double seconds = 4.0, int numChannels = 2)
+    {
+        auto numSamples = (int) (sampleRate * seconds);
+        juce::AudioBuffer<float> input (numChannels, numSamples);
+        input.clear();
+
+        auto segment = numSamples / 4;
+        auto sweepStart = 20.0, sweepEnd = juce::jmin (20000.0, 0.45 * sampleRate);
+        auto sweepRate = std::log (sweepEnd / sweepStart) / segment;
+        juce::Random random (0x601de9);
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            auto* data = input.getWritePointer (channel);
+
+            // Sweep; the phase is the integral of the exponentially rising frequency
+            for (int i = 0; i < segment; ++i)
+                data[i] = 0.5f * (float) std::sin (juce::MathConstants<double>::twoPi * sweepStart * (std::exp (sweepRate * i) - 1.0) / (sweepRate * sampleRate));
+
+            // Impulses every 50 ms, alternating in sign
+            for (int i = segment, n = 0; i < 2 * segment; i += (int) (0.05 * sampleRate), ++n)
+                data[i] = n % 2 == 0 ? 0.9f : -0.9f;
+
+            for (int i = 2 * segment; i < 3 * segment; ++i)
+                data[i] = 0.25f * (2.0f * random.nextFloat() - 1.0f);
+        }
+
+        return input;
+    }
+
+    /// Notes for stages that play MIDI: all notes off first, then a short phrase over
+    /// the first three quarters of the render
+    static juce::MidiBuffer makeMidi (double sampleRate, int numSamples)
+    {
+        juce::MidiBuffer midi;
+        midi.addEvent (juce::MidiMessage::allNotesOff (1), 0);
+
+        auto step = (int) (0.25 * sampleRate);
+        int note = 0;
+
+        for (int start = 0; start + step <= numSamples * 3 / 4; start += step, ++note)
+        {
+            auto noteNumber = 36 + (note * 7) % 24;
+            midi.addEvent (juce::MidiMessage::noteOn (1, noteNumber, 0.8f), start);
+            midi.addEvent (juce::MidiMessage::noteOff (1, noteNumber), start + step / 2);
+        }
+
+        return midi;
+    }
+
+    /// Renders the input in blocks of blockSize samples, the last one possibly shorter
+    static juce::AudioBuffer<float> render (const Render& stage, const juce::AudioBuffer<float>& input, const juce::MidiBuffer& midi, int blockSize)
+    {
+        juce::AudioBuffer<float> output (input);
+        juce::MidiBuffer blockMidi;
+
+        for (int start = 0; start < output.getNumSamples(); start += blockSize)
+        {
+            auto numSamples = juce::jmin (blockSize, output.getNumSamples() - start);
+            juce::AudioBuffer<float> block (output.getArrayOfWritePointers(), output.getNumChannels(), start, numSamples);
+
+            blockMidi.clear();
+            blockMidi.addEvents (midi, start, numSamples, -start);
+            stage (block, blockMidi);
+        }
+
+        return output;
+    }
+
+    static Comparison compare (const juce::AudioBuffer<float>& rendered, const juce::AudioBuffer<float>& reference, Tolerance tolerance)
+    {
+        Comparison result;
+
+        if (rendered.getNumChannels() != reference.getNumChannels() || rendered.getNumSamples() != reference.getNumSamples())
+        {
+            result.error = "expected " + juce::String (reference.getNumChannels()) + " x " + juce::String (reference.getNumSamples())
+                         + " samples, got " + juce::String (rendered.getNumChannels()) + " x " + juce::String (rendered.getNumSamples());
+            return result;
+        }
+
+        double sumOfSquares = 0.0;
+
+        for (int channel = 0; channel < rendered.getNumChannels(); ++channel)
+        {
+            auto* a = rendered.getReadPointer (channel);
+            auto* b = reference.getReadPointer (channel);
+
+            for (int i = 0; i < rendered.getNumSamples(); ++i)
+            {
+                // Bit patterns, so that NaNs and signed zeros count as differences too
+                if (std::memcmp (a + i, b + i, sizeof (float)) != 0 && (result.firstDifference < 0 || i < result.firstDifference))
+                    result.firstDifference = i;
+
+                auto error = std::abs (a[i] - b[i]);
+
+                if (! (error <= result.maxAbsoluteError)) // also catches NaN
+                    result.maxAbsoluteError = std::isnan (error) ? std::numeric_limits<float>::infinity() : error;
+
+                sumOfSquares += (double) error * error;
+            }
+        }
+
+        auto numValues = juce::jmax (1, rendered.getNumChannels() * rendered.getNumSamples());
+        result.rmsError = std::sqrt (sumOfSquares / numValues);
+        result.bitExact = result.firstDifference < 0;
+        result.withinTolerance = result.bitExact
+                              || (result.maxAbsoluteError <= tolerance.maxAbsoluteError && result.rmsError <= tolerance.maxRmsError);
+        return result;
+    }
+
+    static juce::String describe (const Comparison& c)
+    {
+        if (c.error.isNotEmpty())
+            return "FAILED (" + c.error + ")";
+
+        if (c.bitExact)
+            return "bit-exact";
+
+        return juce::String (c.withinTolerance ? "within tolerance" : "FAILED")
+             + " (max error " + juce::String (c.maxAbsoluteError, 8) + ", rms " + juce::String (c.rmsError, 8)
+             + ", first difference at sample " + juce::String (c.firstDifference) + ")";
+    }
+
+    //==============================================================================
+    static bool write (const juce::File& file, const juce::AudioBuffer<float>& buffer, double sampleRate)
+    {
+        file.deleteFile();
+        auto stream = file.createOutputStream();
+
+        if (stream == nullptr)
+            return false;
+
+        // 32 bits makes the WAV writer store IEEE floats, so the render is kept exactly
+        std::unique_ptr<juce::AudioFormatWriter> writer (juce::WavAudioFormat().createWriterFor (stream.get(), sampleRate, (unsigned int) buffer.getNumChannels(), 32, {}, 0));
+
+        if (writer == nullptr)
+            return false;
+
+        stream.release(); // now owned by the writer
+        return writer->writeFromAudioSampleBuffer (buffer, 0, buffer.getNumSamples());
+    }
+
+    static std::optional<juce::AudioBuffer<float>> read (const juce::File& file)
+    {
+        std::unique_ptr<juce::AudioFormatReader> reader (juce::WavAudioFormat().createReaderFor (file.createInputStream().release(), true));
+
+        if (reader == nullptr)
+            return std::nullopt;
+
+        juce::AudioBuffer<float> buffer ((int) reader->numChannels, (int) reader->lengthInSamples);
+
+        if (! reader->read (&buffer, 0, buffer.getNumSamples(), 0, true, true))
+            return std::nullopt;
+
+        return buffer;
+    }
+
+    static juce::File getReferenceFile (const juce::File& folder, const Stage& stage, double sampleRate, int blockSize)
+    {
+        return folder.getChildFile (stage.name + "_" + juce::String (juce::roundToInt (sampleRate)) + "_" + juce::String (blockSize) + ".wav");
+    }
+
+    //==============================================================================
+    /// Renders every stage and compares it with its reference in folder, or writes the
+    /// references when updating them. Returns one line per stage; passed is false if
+    /// any stage is out of tolerance, and referenceMissing is set if any stage has no
+    /// reference to compare with yet.
+    static juce::String run (const juce::File& folder,
+                             const std::vector<Stage>& stages,
+                             double sampleRate,
+                             int blockSize,
+                             bool updateReferences,
+                             bool& passed,
+                             bool& referenceMissing)
+    {
+        auto input = makeInput (sampleRate);
+        auto midi = makeMidi (sampleRate, input.getNumSamples());
+        juce::StringArray lines;
+        passed = true;
+        referenceMissing = false;
+
+        if (updateReferences && ! folder.createDirectory())
+        {
+            passed = false;
+            return "Could not create " + folder.getFullPathName();
+        }
+
+        for (auto& stage : stages)
+        {
+            auto rendered = render (stage.render, input, midi, blockSize);
+            auto file = getReferenceFile (folder, stage, sampleRate, blockSize);
+
+            if (updateReferences)
+            {
+                auto written = write (file, rendered, sampleRate);
+                passed = passed && written;
+                lines.add (stage.name + ": " + (written ? "wrote " + file.getFileName() : "could not write " + file.getFullPathName()));
+                continue;
+            }
+
+            if (auto reference = read (file))
+            {
+                auto comparison = compare (rendered, *reference, stage.tolerance);
+                passed = passed && comparison.withinTolerance;
+                lines.add (stage.name + ": " + describe (comparison));
+            }
+            else
+            {
+                referenceMissing = true;
+                lines.add (stage.name + ": no reference at " + file.getFullPathName());
+            }
+        }
+
+        return lines.joinIntoString ("\n");
+    }
+};
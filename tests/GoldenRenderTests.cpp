@@ -0,0 +1,184 @@
+// Golden-output regression test for the plugin's processing stages, run by ctest.
+//
+// Every stage renders GoldenRender's fixed input at fixed settings and is compared
+// with its reference WAV in GOLDEN_RENDERS_PATH. Only checked-in assets and explicit
+// settings go into a render, never the plugin's saved state:
+//
+//   post    - the post processor with every parameter at its default
+//   cmajor  - the checked-in FilterFX patch, an insert effect with no random state
+//   neural  - GOLDEN_RENDER_MODEL through the LibTorch backend, one parallel processor,
+//             one intra-op thread, anira in non-realtime mode and a fixed torch seed
+//
+// The model and its block size are part of the neural reference's name, so a render
+// is only ever compared with one made from the same model at the same settings.
+//
+// Usage: GoldenRenderTests [--stage post|cmajor|neural] [--update] [--references <dir>]
+//
+// Exits with 0 when every stage passes, 1 when one fails, and 77 (ctest's
+// SKIP_RETURN_CODE) when a stage's asset isn't available on this machine or its
+// reference hasn't been rendered yet.
+
+#include <JuceHeader.h>
+#include <cmajor/helpers/cmaj_Patch.h>
+
+#include "GoldenRender.h"
+#include "neural_configs/InferenceThreading.h"
+#include "processors/NeuralEngine.h"
+#include "processors/PostProcessor.h"
+
+namespace
+{
+constexpr double sampleRate = 48000.0;
+constexpr int blockSize = 512;
+constexpr size_t modelBlockSize = rave_default_block_size;
+constexpr int skipped = 77;
+
+int check (const juce::File& folder, const GoldenRender::Stage& stage, bool updateReferences)
+{
+    bool passed = false, referenceMissing = false;
+    std::cout << GoldenRender::run (folder, { stage }, sampleRate, blockSize, updateReferences, passed, referenceMissing) << std::endl;
+
+    if (! passed)
+        return 1;
+
+    return referenceMissing ? skipped : 0;
+}
+
+int runPost (const juce::File& folder, bool updateReferences)
+{
+    juce::AudioProcessorValueTreeState::ParameterLayout layout;
+    PostProcessorParameters parameters (layout);
+    PostProcessor postProcessor (parameters);
+
+    auto spec = juce::dsp::ProcessSpec { sampleRate, (juce::uint32) blockSize, 2 };
+    postProcessor.prepare (spec);
+
+    // The DSP stages are expected to be bit-exact
+    return check (folder,
+                  { "post",
+                    [&postProcessor] (juce::AudioBuffer<float>& buffer, juce::MidiBuffer&)
+                    {
+                        auto block = juce::dsp::AudioBlock<float> (buffer);
+                        auto context = juce::dsp::ProcessContextReplacing<float> (block);
+                        postProcessor.process (context);
+                    },
+                    {} },
+                  updateReferences);
+}
+
+int runCmajor (const juce::File& folder, bool updateReferences)
+{
+    auto patchFile = juce::File (CMAJOR_PATCHES_PATH).getChildFile ("FilterFX/FilterFX.cmajorpatch");
+
+    if (! patchFile.existsAsFile())
+    {
+        std::cout << "cmajor: skipped, no patch at " << patchFile.getFullPathName() << std::endl;
+        return skipped;
+    }
+
+    cmaj::Patch patch;
+    patch.createEngine = +[]
+    {
+        return cmaj::Engine::create();
+    };
+    patch.setPlaybackParams (cmaj::Patch::PlaybackParams (sampleRate, (uint32_t) blockSize, 2, 2));
+
+    cmaj::Patch::LoadParams loadParams;
+    loadParams.manifest.initialiseWithFile (patchFile.getFullPathName().toStdString());
+
+    if (! patch.loadPatch (loadParams, true) || ! patch.isPlayable())
+    {
+        std::cout << "cmajor: FAILED (could not load " << patchFile.getFullPathName() << ")" << std::endl;
+        return 1;
+    }
+
+    return check (folder,
+                  { "cmajor_FilterFX",
+                    [&patch] (juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midi)
+                    {
+                        for (auto m : midi)
+                            patch.addMIDIMessage (m.samplePosition, m.data, static_cast<uint32_t> (m.numBytes));
+
+                        patch.process (buffer.getArrayOfWritePointers(),
+                                       static_cast<choc::buffer::FrameCount> (buffer.getNumSamples()),
+                                       [] (uint32_t, choc::midi::ShortMessage) {});
+                    },
+                    {} },
+                  updateReferences);
+}
+
+int runNeural (const juce::File& folder, bool updateReferences)
+{
+    juce::File modelFile (GOLDEN_RENDER_MODEL);
+
+    if (! modelFile.existsAsFile())
+    {
+        std::cout << "neural: skipped, no model at " << modelFile.getFullPathName() << std::endl;
+        return skipped;
+    }
+
+    InferenceThreadingOptions options;
+    options.num_parallel_processors = 1;
+    options.intra_op_threads = 1;
+    InferenceThreading::set (options);
+
+    NeuralEngine engine (makeRAVEConfig (modelFile.getFullPathName().toStdString(), 0, RAVERunSettings { modelBlockSize, rave_default_max_inference_time, 1 }), modelFile);
+
+    if (! engine.raveProcessor.getModel().loaded)
+    {
+        std::cout << "neural: FAILED (could not load " << modelFile.getFullPathName() << ")" << std::endl;
+        return 1;
+    }
+
+    engine.setBackend (anira::CUSTOM);
+    engine.prepare ({ (size_t) blockSize, sampleRate });
+    engine.inferenceHandler.set_non_realtime (true);
+    torch::manual_seed (0);
+
+    // Kernels may be picked differently on another machine, so the model gets some slack
+    return check (folder,
+                  { "neural_" + modelFile.getFileNameWithoutExtension() + "_" + juce::String (modelBlockSize),
+                    [&engine] (juce::AudioBuffer<float>& buffer, juce::MidiBuffer&)
+                    { engine.process (juce::dsp::AudioBlock<float> (buffer)); },
+                    { 1.0e-4f, 1.0e-5 } },
+                  updateReferences);
+}
+} // namespace
+
+int main (int argc, char* argv[])
+{
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+    juce::ArgumentList arguments (argc, argv);
+
+    auto updateReferences = arguments.containsOption ("--update");
+    auto folder = arguments.containsOption ("--references") ? juce::File::getCurrentWorkingDirectory().getChildFile (arguments.getValueForOption ("--references"))
+                                                            : juce::File (GOLDEN_RENDERS_PATH);
+    auto stage = arguments.getValueForOption ("--stage");
+
+    std::vector<std::pair<juce::String, std::function<int (const juce::File&, bool)>>> stages { { "post", runPost },
+                                                                                               { "cmajor", runCmajor },
+                                                                                               { "neural", runNeural } };
+    auto result = skipped;
+    auto ranAny = false;
+
+    for (auto& [name, run] : stages)
+    {
+        if (stage.isNotEmpty() && stage != name)
+            continue;
+
+        ranAny = true;
+        auto stageResult = run (folder, updateReferences);
+
+        // A failure wins over a pass, which wins over a skip
+        if (stageResult == 1 || (stageResult == 0 && result == skipped))
+            result = stageResult;
+    }
+
+    if (! ranAny)
+    {
+        std::cout << "Unknown stage " << stage << std::endl;
+        return 1;
+    }
+
+    return result;
+}
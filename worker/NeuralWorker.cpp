@@ -0,0 +1,330 @@
+// Out-of-process neural inference worker.
+//
+// Runs the plugin's RAVEProcessor behind an anira InferenceHandler, reading dry audio
+// from and writing wet audio to the shared-memory rings set up by NeuralProcessor (see
+// NeuralWorkerProtocol.h). A crash or stall in here leaves the host running, and the
+// worker can be pinned to cores that the host's audio threads don't use.
+//
+// Usage: NeuralWorker --shm <name> --model <file.ts> --block-size <host block size>
+//                     --sample-rate <rate> [--model-block-size <size>] [--cpus 2,3]
+//                     [--max-inference-time <ms>] [--parallel <n>] [--optimize] [--quantized]
+//
+// It also runs the threading benchmark, one set of threading options per process, so
+// that anira's process-wide thread pool is created with exactly those options and no
+// engine of the plugin's is running on it:
+//
+//        NeuralWorker --benchmark-threading --model <file.ts> --block-size <n>
+//                     --sample-rate <rate> --tracks <n> [--model-block-size <size>]
+//                     [--blocks <n>] [--threads <n>] [--parallel <n>] [--intra-op <n>]
+//                     [--affinity 2,3] [--rt-priority <1-99>]
+//
+// and prints "RESULT <mean ms> <max ms> <missed deadlines> <realtime tracks>".
+
+#include "neural_configs/NeuralWorkerProtocol.h"
+#include "neural_configs/RAVE.h"
+#include "neural_configs/RAVEPrePostProcessor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace
+{
+std::map<std::string, std::string> parseArguments (int argc, char** argv)
+{
+    std::map<std::string, std::string> arguments;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string key = argv[i];
+
+        if (key.rfind ("--", 0) != 0)
+        {
+            continue;
+        }
+
+        if (i + 1 < argc && std::string (argv[i + 1]).rfind ("--", 0) != 0)
+        {
+            arguments[key] = argv[++i];
+        }
+        else
+        {
+            arguments[key] = "1";
+        }
+    }
+
+    return arguments;
+}
+
+std::vector<int> parseCpuList (const std::string& cpu_list)
+{
+    std::vector<int> cpus;
+    std::stringstream stream (cpu_list);
+    std::string cpu;
+
+    while (std::getline (stream, cpu, ','))
+    {
+        cpus.push_back (std::stoi (cpu));
+    }
+
+    return cpus;
+}
+
+void pinToCpus (const std::string& cpu_list)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO (&set);
+
+    for (auto cpu : parseCpuList (cpu_list))
+    {
+        CPU_SET (cpu, &set);
+    }
+
+    // Threads created from here on, including anira's inference threads, inherit the mask
+    if (sched_setaffinity (0, sizeof (set), &set) != 0)
+    {
+        std::cerr << "[WARNING] could not pin the worker to cpus " << cpu_list << std::endl;
+    }
+#else
+    std::cerr << "[WARNING] cpu pinning is not supported on this platform" << std::endl;
+    (void) cpu_list;
+#endif
+}
+// One host track of the threading benchmark: its own processor and handler, all of them
+// sharing the process's anira context
+struct BenchmarkTrack
+{
+    BenchmarkTrack (const std::string& model, size_t model_block_size, size_t host_block_size, double sample_rate)
+        : config (makeRAVEConfig (model, 2, model_block_size))
+        , backend (config)
+        , pre_post_processor (config)
+        , handler (pre_post_processor, config, backend, anira::ContextConfig (InferenceThreading::getNumInferenceThreads()))
+    {
+        handler.prepare ({ host_block_size, sample_rate });
+        handler.set_inference_backend (anira::CUSTOM);
+        handler.set_non_realtime (true);
+    }
+
+    anira::InferenceConfig config;
+    RAVEProcessor backend;
+    RAVEPrePostProcessor pre_post_processor;
+    anira::InferenceHandler handler;
+};
+
+// Drives every track from its own thread, like a host would, and times each block
+int runThreadingBenchmark (std::map<std::string, std::string>& arguments)
+{
+    auto number = [&arguments] (const std::string& key, double fallback)
+    {
+        return arguments.count (key) > 0 ? std::stod (arguments[key]) : fallback;
+    };
+
+    InferenceThreadingOptions options;
+    options.num_inference_threads = (unsigned int) number ("--threads", 0);
+    options.num_parallel_processors = (unsigned int) number ("--parallel", 0);
+    options.intra_op_threads = (int) number ("--intra-op", 1);
+    options.realtime_priority = (int) number ("--rt-priority", 0);
+
+    if (arguments.count ("--affinity") > 0)
+    {
+        options.cpu_affinity = parseCpuList (arguments["--affinity"]);
+    }
+
+    InferenceThreading::set (options);
+
+    auto host_block_size = (size_t) number ("--block-size", 512);
+    auto sample_rate = number ("--sample-rate", 48000.0);
+    auto model_block_size = (size_t) number ("--model-block-size", (double) rave_default_block_size);
+    auto num_tracks = (size_t) std::max (1.0, number ("--tracks", 8));
+    auto num_blocks = std::max (1, (int) number ("--blocks", 100));
+    const int num_warm_up_blocks = 5;
+
+    std::vector<std::unique_ptr<BenchmarkTrack>> tracks;
+
+    for (size_t i = 0; i < num_tracks; ++i)
+    {
+        tracks.push_back (std::make_unique<BenchmarkTrack> (arguments["--model"], model_block_size, host_block_size, sample_rate));
+
+        if (! tracks.back()->backend.getModel().loaded)
+        {
+            std::cerr << "[ERROR] could not load " << arguments["--model"] << std::endl;
+            return 1;
+        }
+    }
+
+    struct Timing
+    {
+        double total_ms = 0.0, max_ms = 0.0;
+        int missed = 0;
+    };
+
+    std::vector<Timing> timings (num_tracks);
+    std::vector<std::thread> threads;
+    auto block_ms = 1000.0 * (double) host_block_size / sample_rate;
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < num_tracks; ++i)
+    {
+        threads.emplace_back ([&, i]
+                              {
+                                  std::mt19937 random ((unsigned int) i);
+                                  std::uniform_real_distribution<float> noise (-1.0f, 1.0f);
+                                  std::vector<std::vector<float>> buffers (rave_num_audio_channels, std::vector<float> (host_block_size));
+                                  std::vector<float*> channels;
+
+                                  for (auto& buffer : buffers)
+                                  {
+                                      channels.push_back (buffer.data());
+                                  }
+
+                                  for (int block = -num_warm_up_blocks; block < num_blocks; ++block)
+                                  {
+                                      for (auto& buffer : buffers)
+                                      {
+                                          for (auto& sample : buffer)
+                                          {
+                                              sample = noise (random);
+                                          }
+                                      }
+
+                                      auto block_start = std::chrono::steady_clock::now();
+                                      tracks[i]->handler.process (channels.data(), host_block_size);
+                                      auto elapsed = std::chrono::duration<double, std::milli> (std::chrono::steady_clock::now() - block_start).count();
+
+                                      if (block >= 0)
+                                      {
+                                          timings[i].total_ms += elapsed;
+                                          timings[i].max_ms = std::max (timings[i].max_ms, elapsed);
+                                          timings[i].missed += elapsed > block_ms ? 1 : 0;
+                                      }
+                                  }
+                              });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    auto wall_seconds = std::chrono::duration<double> (std::chrono::steady_clock::now() - start).count();
+    double mean_ms = 0.0, max_ms = 0.0;
+    int missed = 0;
+
+    for (auto& timing : timings)
+    {
+        mean_ms += timing.total_ms / num_blocks / (double) num_tracks;
+        max_ms = std::max (max_ms, timing.max_ms);
+        missed += timing.missed;
+    }
+
+    auto audio_seconds = (double) num_tracks * (num_blocks + num_warm_up_blocks) * (double) host_block_size / sample_rate;
+    std::cout << "RESULT " << mean_ms << " " << max_ms << " " << missed << " " << (wall_seconds > 0.0 ? audio_seconds / wall_seconds : 0.0) << std::endl;
+    return 0;
+}
+} // namespace
+
+int main (int argc, char** argv)
+{
+    auto arguments = parseArguments (argc, argv);
+
+    if (arguments.count ("--benchmark-threading") > 0 && arguments.count ("--model") > 0)
+    {
+        return runThreadingBenchmark (arguments);
+    }
+
+    if (arguments.count ("--shm") == 0 || arguments.count ("--model") == 0 || arguments.count ("--block-size") == 0 || arguments.count ("--sample-rate") == 0)
+    {
+        std::cerr << "usage: NeuralWorker --shm <name> --model <file.ts> --block-size <n> --sample-rate <rate> [--model-block-size <n>] [--cpus 2,3] [--max-inference-time <ms>] [--parallel <n>] [--optimize] [--quantized]" << std::endl;
+        return 1;
+    }
+
+    if (arguments.count ("--cpus") > 0)
+    {
+        pinToCpus (arguments["--cpus"]);
+    }
+
+    neural_worker::SharedChannel channel;
+
+    if (! channel.open (arguments["--shm"]))
+    {
+        std::cerr << "[ERROR] could not open shared memory " << arguments["--shm"] << std::endl;
+        return 1;
+    }
+
+    auto& state = channel.getState();
+    auto host_block_size = (size_t) std::stoul (arguments["--block-size"]);
+    auto sample_rate = std::stod (arguments["--sample-rate"]);
+    auto model_block_size = arguments.count ("--model-block-size") > 0 ? (size_t) std::stoul (arguments["--model-block-size"]) : rave_default_block_size;
+    auto max_inference_time = arguments.count ("--max-inference-time") > 0 ? std::stof (arguments["--max-inference-time"]) : rave_default_max_inference_time;
+    auto num_parallel_processors = arguments.count ("--parallel") > 0 ? (unsigned int) std::stoul (arguments["--parallel"]) : 0u;
+
+    RAVEProcessor::LoadOptions load_options;
+    load_options.optimize = arguments.count ("--optimize") > 0;
+    load_options.quantized = arguments.count ("--quantized") > 0;
+
+    auto config = makeRAVEConfig (arguments["--model"], 4, { model_block_size, max_inference_time, num_parallel_processors });
+    RAVEProcessor backend (config, load_options);
+
+    if (! backend.getModel().loaded || state.num_channels != rave_num_audio_channels || host_block_size > state.ring_capacity / 2)
+    {
+        state.failed.store (1);
+        return 1;
+    }
+
+    RAVEPrePostProcessor pre_post_processor (config);
+    anira::InferenceHandler inference_handler (pre_post_processor, config, backend);
+    inference_handler.prepare ({ host_block_size, sample_rate });
+    inference_handler.set_inference_backend (anira::CUSTOM);
+
+    std::vector<std::vector<float>> buffers (state.num_channels, std::vector<float> (host_block_size, 0.0f));
+    std::vector<float*> channels;
+
+    for (auto& buffer : buffers)
+    {
+        channels.push_back (buffer.data());
+    }
+
+    // One block of silence keeps the plugin a block behind the worker, so that a block
+    // sent in one callback has come back by the next. That block is part of the latency.
+    channel.getFromWorker().write (channels.data(), host_block_size);
+    state.latency.store ((int32_t) (inference_handler.get_latency() + host_block_size));
+    state.ready.store (1);
+
+    int idle_rounds = 0;
+
+    while (state.stop_requested.load() == 0)
+    {
+        state.heartbeat.fetch_add (1, std::memory_order_relaxed);
+
+        // Whatever has arrived, up to a block: the host's callbacks may be shorter
+        auto num_samples = std::min ({ channel.getToWorker().getNumReady(), channel.getFromWorker().getFreeSpace(), host_block_size });
+
+        if (num_samples > 0)
+        {
+            channel.getToWorker().read (channels.data(), num_samples);
+            inference_handler.process (channels.data(), num_samples);
+            channel.getFromWorker().write (channels.data(), num_samples);
+            idle_rounds = 0;
+        }
+        else if (++idle_rounds < 1000)
+        {
+            std::this_thread::yield();
+        }
+        else
+        {
+            std::this_thread::sleep_for (std::chrono::microseconds (100));
+        }
+    }
+
+    return 0;
+}